@@ -0,0 +1,395 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Throughput benchmarks for the decoder, the encoder, the crc32 engine and the header parser, run over synthetic
+ * articles. Every result is printed as one line of CSV, or of JSON with --json, so the output of two releases
+ * can be compared with diff.
+ *
+ * The kernels in use are printed to stderr. --level runs the kernels of a lower instruction set level instead, like the
+ * YENC_FORCE_LEVEL environment variable.
+ *
+ * usage: yenc_bench [--json] [--size <MB>] [--time <seconds>] [--level <scalar|sse2|ssse3|sse4.1|avx2|avx512>]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+#include "ycrc32.h"
+#include "ydecoder.h"
+#include "ydispatch.h"
+#include "yencoder.h"
+#include "yheader.h"
+#include "ykernel.h"
+
+using namespace ydecoder;
+using namespace yencoder;
+
+namespace{
+
+    std::atomic<unsigned long> allocations( 0 );
+
+    /**
+     * The size of the parts of the multipart benchmarks, a common size for posts.
+     */
+    const size_t part_size = 768000;
+
+}
+
+/*
+ * Count every allocation made while a benchmark runs. The array forms forward to these.
+ */
+void* operator new( size_t size )
+{
+    allocations++;
+    void *p = malloc( size ? size : 1 );
+
+    if( !p )
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete( void *p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void *p, size_t ) noexcept
+{
+    free( p );
+}
+
+namespace{
+
+    struct Options{
+        size_t size;
+        double time;
+        bool json;
+    };
+
+    /**
+     * The outcome of running one benchmark repeatedly.
+     */
+    struct Measurement{
+        double seconds;
+        uint64_t cycles;
+        unsigned long allocations;
+        unsigned long iterations;
+    };
+
+    inline uint64_t readCycles()
+    {
+#if defined( __x86_64__ ) || defined( __i386__ )
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Run @p job once to warm up, then repeatedly until @p min_time seconds have passed.
+     */
+    template<class Job>
+    Measurement measure( Job job, double min_time )
+    {
+        job();
+
+        Measurement m = { 0, 0, 0, 0 };
+        unsigned long allocated = allocations;
+        uint64_t cycles = readCycles();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        do{
+            job();
+            m.iterations++;
+            m.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        }while( m.seconds < min_time || m.iterations < 3 );
+
+        m.cycles = readCycles() - cycles;
+        m.allocations = allocations - allocated;
+        return m;
+    }
+
+    void report( const Options &options, const char *operation, const char *corpus, const char *layout, unsigned int line_length,
+                 const char *line_ending, size_t bytes, const Measurement &m )
+    {
+        double total = static_cast<double>( bytes ) * m.iterations;
+        double mb_per_s = total / m.seconds / 1e6;
+        double cycles_per_byte = m.cycles / total;
+        double allocs = static_cast<double>( m.allocations ) / m.iterations;
+
+        if( options.json )
+            printf( "{\"operation\":\"%s\",\"corpus\":\"%s\",\"layout\":\"%s\",\"line_length\":%u,\"line_ending\":\"%s\","
+                    "\"bytes\":%zu,\"mb_per_s\":%.1f,\"cycles_per_byte\":%.3f,\"allocations_per_iteration\":%.2f}\n",
+                    operation, corpus, layout, line_length, line_ending, bytes, mb_per_s, cycles_per_byte, allocs );
+        else
+            printf( "%s,%s,%s,%u,%s,%zu,%.1f,%.3f,%.2f\n", operation, corpus, layout, line_length, line_ending, bytes,
+                    mb_per_s, cycles_per_byte, allocs );
+
+        fflush( stdout );
+    }
+
+    /**
+     * Generate the data to encode. "zero" needs no escaping at all, "random" has the usual escape density of about
+     * 1.6%, and "worst" consists only of bytes that encode to NUL, LF, CR or '=', so every byte is escaped.
+     */
+    string makeCorpus( const char *kind, size_t size )
+    {
+        string data( size, '\0' );
+
+        if( strcmp( kind, "random" ) == 0 ){
+            uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+            for( size_t i = 0; i < size; i++ ){
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                data[i] = static_cast<char>( state );
+            }
+
+        }else if( strcmp( kind, "worst" ) == 0 ){
+            static const unsigned char critical[] = { 214, 224, 227, 19 };
+
+            for( size_t i = 0; i < size; i++ )
+                data[i] = critical[i % 4];
+
+        }
+
+        return data;
+    }
+
+    /**
+     * Encode a slice of @p data as an article. @p part is 0 for a single part article.
+     */
+    string makeArticle( const string &data, size_t begin, size_t length, int part, int total, unsigned int line_length, bool crlf )
+    {
+        char header[256], trailer[128];
+        uint32_t pcrc = ycrc32::crc32( 0, data.data() + begin, length );
+        string article;
+
+        if( part ){
+            uint32_t crc = ycrc32::crc32( 0, data.data(), data.size() );
+            snprintf( header, sizeof( header ), "=ybegin part=%d total=%d line=%u size=%zu name=bench.bin\r\n=ypart begin=%zu end=%zu\r\n",
+                      part, total, line_length, data.size(), begin + 1, begin + length );
+            snprintf( trailer, sizeof( trailer ), "\r\n=yend size=%zu part=%d pcrc32=%08x crc32=%08x\r\n", length, part, pcrc, crc );
+        }else{
+            snprintf( header, sizeof( header ), "=ybegin line=%u size=%zu name=bench.bin\r\n", line_length, length );
+            snprintf( trailer, sizeof( trailer ), "\r\n=yend size=%zu crc32=%08x\r\n", length, pcrc );
+        }
+
+        string body( ykernel::encodedSizeBound( length, line_length ), '\0' );
+        unsigned int column = 0;
+        body.resize( ykernel::encode( reinterpret_cast<const unsigned char*>( data.data() + begin ), length,
+                                      reinterpret_cast<unsigned char*>( &body[0] ), line_length, column, true ) );
+        article = header + body + trailer;
+
+        if( !crlf ){
+            string lf;
+            lf.reserve( article.size() );
+
+            for( size_t i = 0; i < article.size(); i++ ){
+
+                if( article[i] != '\r' )
+                    lf += article[i];
+
+            }
+
+            article.swap( lf );
+        }
+
+        return article;
+    }
+
+    void benchDecode( const Options &options, const char *corpus, const string &data )
+    {
+        static const unsigned int line_lengths[] = { 128, 1024 };
+
+        for( int multipart = 0; multipart < 2; multipart++ ){
+
+            for( size_t l = 0; l < sizeof( line_lengths ) / sizeof( line_lengths[0] ); l++ ){
+
+                for( int crlf = 1; crlf >= 0; crlf-- ){
+                    vector<string> articles;
+
+                    if( multipart ){
+                        int total = static_cast<int>( ( data.size() + part_size - 1 ) / part_size );
+
+                        for( int part = 0; part < total; part++ ){
+                            size_t begin = part * part_size;
+                            articles.push_back( makeArticle( data, begin, min( part_size, data.size() - begin ), part + 1, total,
+                                                             line_lengths[l], crlf ) );
+                        }
+
+                    }else{
+                        articles.push_back( makeArticle( data, 0, data.size(), 0, 0, line_lengths[l], crlf ) );
+                    }
+
+                    YDecoder decoder;
+                    vector<char> output( multipart ? min( part_size, data.size() ) : data.size() );
+                    DecoderStatus::Status status = DecoderStatus::SUCCESS;
+
+                    Measurement m = measure( [&]{
+                        for( size_t i = 0; i < articles.size(); i++ )
+                            status = decoder.decode( articles[i].data(), articles[i].size(), output.data(), output.size() ).status;
+                    }, options.time );
+
+                    if( status != DecoderStatus::SUCCESS ){
+                        fprintf( stderr, "decode of %s failed with status %d\n", corpus, status );
+                        exit( EXIT_FAILURE );
+                    }
+
+                    report( options, "decode", corpus, multipart ? "multi" : "single", line_lengths[l], crlf ? "crlf" : "lf",
+                            data.size(), m );
+                }
+
+            }
+
+        }
+    }
+
+    void benchEncode( const Options &options, const char *corpus, const string &data )
+    {
+        static const unsigned int line_lengths[] = { 128, 1024 };
+
+        for( size_t l = 0; l < sizeof( line_lengths ) / sizeof( line_lengths[0] ); l++ ){
+            YEncoder encoder( line_lengths[l] );
+            string output;
+
+            Measurement m = measure( [&]{
+                encoder.encode( data.data(), data.size(), "bench.bin", output );
+            }, options.time );
+
+            report( options, "encode", corpus, "single", line_lengths[l], "crlf", data.size(), m );
+
+            vector<string> parts;
+
+            m = measure( [&]{
+                encoder.encode( data.data(), data.size(), "bench.bin", part_size, parts );
+            }, options.time );
+
+            report( options, "encode", corpus, "multi", line_lengths[l], "crlf", data.size(), m );
+        }
+    }
+
+    void benchCrc( const Options &options, const string &data )
+    {
+        static const size_t blocks[] = { 64, 4096, 0 };
+
+        for( size_t b = 0; b < sizeof( blocks ) / sizeof( blocks[0] ); b++ ){
+            size_t block = blocks[b] ? blocks[b] : data.size();
+            char layout[32];
+            snprintf( layout, sizeof( layout ), "block%zu", block );
+            volatile uint32_t sink = 0;
+
+            Measurement m = measure( [&]{
+                uint32_t crc = 0;
+
+                for( size_t i = 0; i + block <= data.size(); i += block )
+                    crc = ycrc32::crc32( crc, data.data() + i, block );
+
+                sink = crc;
+            }, options.time );
+
+            report( options, "crc32", "random", layout, 0, "none", data.size() / block * block, m );
+        }
+    }
+
+    void benchHeader( const Options &options )
+    {
+        static const char begin_line[] = "=ybegin part=17 total=250 line=128 size=192000000 name=some file name.part017.rar\r\n";
+        static const char part_line[] = "=ypart begin=12288001 end=13056000\r\n";
+        static const char end_line[] = "=yend size=768000 part=17 pcrc32=4f3a2c1b crc32=00f1e2d3\r\n";
+        const size_t bytes = sizeof( begin_line ) + sizeof( part_line ) + sizeof( end_line ) - 3;
+        const int repeat = 1000;
+        volatile uint64_t sink = 0;
+
+        Measurement m = measure( [&]{
+            for( int i = 0; i < repeat; i++ ){
+                yheader::YencHeader header;
+                yheader::YencTrailer trailer;
+                yheader::parseBegin( begin_line, begin_line + sizeof( begin_line ) - 1, header );
+                yheader::parsePart( part_line, part_line + sizeof( part_line ) - 1, header );
+                yheader::parseEnd( end_line, end_line + sizeof( end_line ) - 1, trailer );
+                sink = header.begin + header.name.size() + trailer.pcrc;
+            }
+        }, options.time );
+
+        report( options, "header", "article", "multi", 0, "crlf", bytes * repeat, m );
+    }
+
+    void usage()
+    {
+        fprintf( stderr, "usage: yenc_bench [--json] [--size <MB>] [--time <seconds>] [--level <scalar|sse2|ssse3|sse4.1|avx2|avx512>]\n" );
+        exit( EXIT_FAILURE );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    Options options = { 16 << 20, 0.5, false };
+    ydispatch::CpuLevel::Level level;
+
+    for( int i = 1; i < argc; i++ ){
+
+        if( strcmp( argv[i], "--json" ) == 0 )
+            options.json = true;
+        else if( strcmp( argv[i], "--size" ) == 0 && i + 1 < argc )
+            options.size = static_cast<size_t>( atof( argv[++i] ) * ( 1 << 20 ) );
+        else if( strcmp( argv[i], "--time" ) == 0 && i + 1 < argc )
+            options.time = atof( argv[++i] );
+        else if( strcmp( argv[i], "--level" ) == 0 && i + 1 < argc && ydispatch::parseLevel( argv[++i], level ) )
+            ydispatch::setLevel( level );
+        else
+            usage();
+
+    }
+
+    if( !options.size )
+        usage();
+
+    ydispatch::Kernels kernels = ydispatch::kernels();
+    fprintf( stderr, "level %s of %s: decode %s, encode %s, crc32 %s\n", ydispatch::levelName( ydispatch::level() ),
+             ydispatch::levelName( ydispatch::supported() ), kernels.decode, kernels.encode, kernels.crc32 );
+
+    if( !options.json )
+        printf( "operation,corpus,layout,line_length,line_ending,bytes,mb_per_s,cycles_per_byte,allocations_per_iteration\n" );
+
+    static const char *corpora[] = { "zero", "random", "worst" };
+
+    for( size_t c = 0; c < sizeof( corpora ) / sizeof( corpora[0] ); c++ ){
+        string data = makeCorpus( corpora[c], options.size );
+        benchDecode( options, corpora[c], data );
+        benchEncode( options, corpora[c], data );
+
+        if( strcmp( corpora[c], "random" ) == 0 )
+            benchCrc( options, data );
+
+    }
+
+    benchHeader( options );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ybuffer.h"
+
+namespace ybuffer{
+
+    namespace{
+
+        /**
+         * The size of the smallest block, as a power of two.
+         */
+        const unsigned int min_order = 12;
+
+        /**
+         * @return The power of two of the smallest block size that holds @p size bytes.
+         */
+        unsigned int blockOrder( size_t size )
+        {
+            unsigned int order = min_order;
+
+            while( order < 63 && ( static_cast<size_t>( 1 ) << order ) < size )
+                order++;
+
+            return order;
+        }
+
+    }
+
+    BufferPool::BufferPool()
+        : cached_bytes( 0 )
+    {
+    }
+
+    BufferPool::~BufferPool()
+    {
+        trim();
+    }
+
+    char* BufferPool::acquire( size_t size, size_t &capacity )
+    {
+        unsigned int order = blockOrder( size );
+        capacity = static_cast<size_t>( 1 ) << order;
+
+        if( !free_lists[order].empty() ){
+            char *block = free_lists[order].back();
+            free_lists[order].pop_back();
+            cached_bytes -= capacity;
+            return block;
+        }
+
+        void *block;
+
+        if( posix_memalign( &block, alignment, capacity ) != 0 ){
+            capacity = 0;
+            return NULL;
+        }
+
+        return static_cast<char*>( block );
+    }
+
+    void BufferPool::release( char *block, size_t capacity )
+    {
+        if( !block )
+            return;
+
+        free_lists[blockOrder( capacity )].push_back( block );
+        cached_bytes += capacity;
+    }
+
+    void BufferPool::trim()
+    {
+        for( unsigned int i = 0; i < sizeof( free_lists ) / sizeof( free_lists[0] ); i++ ){
+
+            for( size_t j = 0; j < free_lists[i].size(); j++ )
+                free( free_lists[i][j] );
+
+            std::vector<char*>().swap( free_lists[i] );
+        }
+
+        cached_bytes = 0;
+    }
+
+    uint64_t BufferPool::cached() const
+    {
+        return cached_bytes;
+    }
+
+    BufferPool& BufferPool::local()
+    {
+        thread_local BufferPool pool;
+        return pool;
+    }
+
+    char* Buffer::reserve( size_t size )
+    {
+        if( block && size <= length )
+            return block;
+
+        release();
+        block = pool->acquire( size, length );
+        origin = block ? pool : NULL;
+        return block;
+    }
+
+    void Buffer::release()
+    {
+        if( origin )
+            origin->release( block, length );
+
+        origin = NULL;
+        block = NULL;
+        length = 0;
+    }
+
+    Arena::Arena( BufferPool *pool )
+        : pool( pool ), current( 0 ), used( 0 )
+    {
+    }
+
+    Arena::~Arena()
+    {
+        for( size_t i = 0; i < chunks.size(); i++ )
+            chunks[i].origin->release( chunks[i].block, chunks[i].capacity );
+
+    }
+
+    char* Arena::allocate( size_t size )
+    {
+        //Keep every allocation aligned like malloc would
+        size = ( size + sizeof( void* ) - 1 ) & ~( sizeof( void* ) - 1 );
+
+        for( ; current < chunks.size(); current++, used = 0 ){
+
+            if( chunks[current].capacity - used >= size ){
+                char *memory = chunks[current].block + used;
+                used += size;
+                return memory;
+            }
+
+        }
+
+        Chunk chunk;
+
+        if( !( chunk.block = pool->acquire( size, chunk.capacity ) ) )
+            return NULL;
+
+        chunk.origin = pool;
+        chunks.push_back( chunk );
+        current = chunks.size() - 1;
+        used = size;
+        return chunk.block;
+    }
+
+    boost::string_view Arena::copy( const char *text, size_t length )
+    {
+        char *memory = allocate( length + 1 );
+
+        if( !memory )
+            return boost::string_view();
+
+        //A missing header value has no text to copy
+        if( length )
+            memcpy( memory, text, length );
+
+        memory[length] = '\0';
+        return boost::string_view( memory, length );
+    }
+
+}
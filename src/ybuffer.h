@@ -0,0 +1,218 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ybuffer
+ * The namespace for the recycled memory of the decoders, so decoding one article after another doesn't allocate.
+ */
+#ifndef YBUFFER_YBUFFER_H
+#define YBUFFER_YBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+
+namespace ybuffer{
+
+    /**
+     * @class BufferPool ybuffer.h
+     *
+     * @brief Keeps the blocks of memory the decoders are done with, to hand them out again.
+     *
+     * Blocks come in sizes that are powers of two, from 4 KB up, and start on a cache line. A released block is kept
+     * on a free list for its size, so once the decoders have seen the largest article they are going to see, asking
+     * for a block is a pop from a list and no longer reaches the heap. The blocks are only freed when the pool is
+     * destroyed, or trim() is called.
+     *
+     * A pool is not thread safe. Each YDecoder has a pool of its own, and decoders that are used on the same thread
+     * can share one, such as the one local() returns, so they keep one set of blocks between them instead of a set
+     * each.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class BufferPool
+    {
+        public:
+            /**
+             * The alignment of the blocks, which is the size of a cache line.
+             */
+            static const size_t alignment = 64;
+
+            BufferPool();
+
+            /**
+             * Frees the blocks on the free lists. Blocks still in use must not be released after this.
+             */
+            ~BufferPool();
+
+            /**
+             * Take a block of at least @p size bytes.
+             *
+             * @param capacity Receives the size of the block, which is to be passed back to release().
+             *
+             * @return The block, or NULL if there isn't enough memory.
+             */
+            char* acquire( size_t size, size_t &capacity );
+
+            /**
+             * Hand a block back to the pool, to be given out again.
+             */
+            void release( char *block, size_t capacity );
+
+            /**
+             * Free the blocks on the free lists.
+             */
+            void trim();
+
+            /**
+             * @return The number of bytes held in the free lists.
+             */
+            uint64_t cached() const;
+
+            /**
+             * @return The pool shared by the decoders on the calling thread.
+             */
+            static BufferPool& local();
+
+        private:
+            //Variables
+            std::vector<char*> free_lists[64];
+            uint64_t cached_bytes;
+
+            BufferPool( const BufferPool& );
+            BufferPool& operator=( const BufferPool& );
+    };
+
+    /**
+     * @class Buffer ybuffer.h
+     *
+     * @brief A block from a pool, which is replaced by a larger one when more room is asked for.
+     *
+     * Unlike a vector, growing the buffer doesn't copy or clear anything, so it suits buffers that are written from
+     * scratch for each article. The block always goes back to the pool it came from, even if the buffer has been
+     * pointed at a different pool since.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Buffer
+    {
+        public:
+            /**
+             * @param pool The pool to take the blocks from.
+             */
+            explicit Buffer( BufferPool *pool ) : pool( pool ), origin( NULL ), block( NULL ), length( 0 ){}
+
+            ~Buffer(){ release(); }
+
+            /**
+             * Take the blocks from @p pool from now on.
+             */
+            void setPool( BufferPool *pool ){ this->pool = pool; }
+
+            /**
+             * Make sure the buffer holds at least @p size bytes. If it has to grow, its contents are lost.
+             *
+             * @return The start of the buffer, or NULL if there isn't enough memory.
+             */
+            char* reserve( size_t size );
+
+            /**
+             * Hand the block back to its pool.
+             */
+            void release();
+
+            char* data() const { return block; }
+            size_t capacity() const { return length; }
+
+        private:
+            BufferPool *pool, *origin;
+            char *block;
+            size_t length;
+
+            Buffer( const Buffer& );
+            Buffer& operator=( const Buffer& );
+    };
+
+    /**
+     * @class Arena ybuffer.h
+     *
+     * @brief Hands out memory for short lived strings, such as the values of a header, and takes it all back at once.
+     *
+     * The memory comes from a few blocks of a pool that are used from start to end. reset() simply starts over at the
+     * start of the first block, whatever has been allocated, and the blocks are kept for the next round, so an arena
+     * that is reset between articles stops taking memory from the pool once it has seen the longest header.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Arena
+    {
+        public:
+            /**
+             * @param pool The pool to take the blocks from.
+             */
+            explicit Arena( BufferPool *pool );
+
+            /**
+             * Hands the blocks back to their pools.
+             */
+            ~Arena();
+
+            /**
+             * Take the blocks from @p pool from now on.
+             */
+            void setPool( BufferPool *pool ){ this->pool = pool; }
+
+            /**
+             * @return @p size bytes of memory, valid until the next reset(), or NULL if there isn't enough memory.
+             */
+            char* allocate( size_t size );
+
+            /**
+             * Copy a string into the arena. The copy is null terminated.
+             *
+             * @return The copy, valid until the next reset().
+             */
+            boost::string_view copy( const char *text, size_t length );
+
+            /**
+             * Take back everything allocated so far.
+             */
+            void reset(){ current = 0; used = 0; }
+
+        private:
+            struct Chunk{
+                char *block;
+                size_t capacity;
+                BufferPool *origin;
+            };
+
+            //Variables
+            BufferPool *pool;
+            std::vector<Chunk> chunks;
+            size_t current, used;
+
+            Arena( const Arena& );
+            Arena& operator=( const Arena& );
+    };
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <string.h>
+#include <immintrin.h>
+#include "ycrc32.h"
+#include "ydispatch.h"
+
+namespace ycrc32{
+
+    namespace{
+
+        /**
+         * The reflected crc32 polynomial.
+         */
+        const uint32_t polynomial = 0xedb88320;
+
+        /**
+         * Tables for slice-by-16. table[0] is the classic byte at a time table, table[k] advances a byte through k more
+         * zero bytes, so that 16 bytes can be looked up independently and combined with xor.
+         */
+        struct SliceTable{
+            uint32_t table[16][256];
+
+            SliceTable()
+            {
+                for( uint32_t i = 0; i < 256; i++ ){
+                    uint32_t crc = i;
+
+                    for( int bit = 0; bit < 8; bit++ )
+                        crc = crc & 1 ? ( crc >> 1 ) ^ polynomial : crc >> 1;
+
+                    table[0][i] = crc;
+                }
+
+                for( int k = 1; k < 16; k++ ){
+
+                    for( int i = 0; i < 256; i++ )
+                        table[k][i] = ( table[k - 1][i] >> 8 ) ^ table[0][table[k - 1][i] & 0xff];
+
+                }
+            }
+        };
+
+        const SliceTable slice_table;
+
+        inline uint32_t load32( const unsigned char *data )
+        {
+            uint32_t value;
+            memcpy( &value, data, sizeof( value ) );
+            return value;
+        }
+
+        /*
+         * The kernels below work on the raw crc register, ie. the checksum before the final inversion.
+         */
+
+        uint32_t crc32Slice16( uint32_t crc, const unsigned char *data, size_t length )
+        {
+            const uint32_t ( *t )[256] = slice_table.table;
+
+            for( ; length >= 16; data += 16, length -= 16 ){
+                uint32_t a = load32( data ) ^ crc;
+                uint32_t b = load32( data + 4 );
+                uint32_t c = load32( data + 8 );
+                uint32_t d = load32( data + 12 );
+
+                crc = t[15][a & 0xff] ^ t[14][( a >> 8 ) & 0xff] ^ t[13][( a >> 16 ) & 0xff] ^ t[12][a >> 24] ^
+                      t[11][b & 0xff] ^ t[10][( b >> 8 ) & 0xff] ^ t[9][( b >> 16 ) & 0xff] ^ t[8][b >> 24] ^
+                      t[7][c & 0xff] ^ t[6][( c >> 8 ) & 0xff] ^ t[5][( c >> 16 ) & 0xff] ^ t[4][c >> 24] ^
+                      t[3][d & 0xff] ^ t[2][( d >> 8 ) & 0xff] ^ t[1][( d >> 16 ) & 0xff] ^ t[0][d >> 24];
+            }
+
+            for( ; length; data++, length-- )
+                crc = t[0][( crc ^ *data ) & 0xff] ^ ( crc >> 8 );
+
+            return crc;
+        }
+
+        /**
+         * Fold the data four registers at a time with carry-less multiplication, then reduce the remainder with a
+         * Barrett reduction, following Gopal et al., "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+         * Instruction". @p length must be a multiple of 16 and at least 64.
+         */
+        __attribute__(( target( "pclmul,sse4.1" ) ))
+        uint32_t crc32Fold( uint32_t crc, const unsigned char *data, size_t length )
+        {
+            const __m128i k1k2 = _mm_set_epi64x( 0x01c6e41596LL, 0x0154442bd4LL );
+            const __m128i k3k4 = _mm_set_epi64x( 0x00ccaa009eLL, 0x01751997d0LL );
+            const __m128i k5k0 = _mm_set_epi64x( 0, 0x0163cd6124LL );
+            const __m128i poly = _mm_set_epi64x( 0x01f7011641LL, 0x01db710641LL );
+            const __m128i low32 = _mm_setr_epi32( ~0, 0, ~0, 0 );
+
+            __m128i x1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) );
+            __m128i x2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 16 ) );
+            __m128i x3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 32 ) );
+            __m128i x4 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 48 ) );
+            x1 = _mm_xor_si128( x1, _mm_cvtsi32_si128( crc ) );
+            data += 64;
+            length -= 64;
+
+            //Fold four 128 bit registers in parallel
+            for( ; length >= 64; data += 64, length -= 64 ){
+                __m128i x5 = _mm_clmulepi64_si128( x1, k1k2, 0x00 );
+                __m128i x6 = _mm_clmulepi64_si128( x2, k1k2, 0x00 );
+                __m128i x7 = _mm_clmulepi64_si128( x3, k1k2, 0x00 );
+                __m128i x8 = _mm_clmulepi64_si128( x4, k1k2, 0x00 );
+                x1 = _mm_clmulepi64_si128( x1, k1k2, 0x11 );
+                x2 = _mm_clmulepi64_si128( x2, k1k2, 0x11 );
+                x3 = _mm_clmulepi64_si128( x3, k1k2, 0x11 );
+                x4 = _mm_clmulepi64_si128( x4, k1k2, 0x11 );
+                x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) ) );
+                x2 = _mm_xor_si128( _mm_xor_si128( x2, x6 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 16 ) ) );
+                x3 = _mm_xor_si128( _mm_xor_si128( x3, x7 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 32 ) ) );
+                x4 = _mm_xor_si128( _mm_xor_si128( x4, x8 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + 48 ) ) );
+            }
+
+            //Fold the four registers into one
+            __m128i x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+            x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x2 ), x5 );
+            x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+            x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x3 ), x5 );
+            x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+            x1 = _mm_xor_si128( _mm_xor_si128( _mm_clmulepi64_si128( x1, k3k4, 0x11 ), x4 ), x5 );
+
+            //Fold in the remaining 16 byte blocks
+            for( ; length >= 16; data += 16, length -= 16 ){
+                x5 = _mm_clmulepi64_si128( x1, k3k4, 0x00 );
+                x1 = _mm_clmulepi64_si128( x1, k3k4, 0x11 );
+                x1 = _mm_xor_si128( _mm_xor_si128( x1, x5 ), _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) ) );
+            }
+
+            //Fold 128 bits down to 64
+            x2 = _mm_clmulepi64_si128( x1, k3k4, 0x10 );
+            x1 = _mm_xor_si128( _mm_srli_si128( x1, 8 ), x2 );
+            x2 = _mm_srli_si128( x1, 4 );
+            x1 = _mm_and_si128( x1, low32 );
+            x1 = _mm_xor_si128( _mm_clmulepi64_si128( x1, k5k0, 0x00 ), x2 );
+
+            //Barrett reduction down to 32 bits
+            x2 = _mm_and_si128( x1, low32 );
+            x2 = _mm_clmulepi64_si128( x2, poly, 0x10 );
+            x2 = _mm_and_si128( x2, low32 );
+            x2 = _mm_clmulepi64_si128( x2, poly, 0x00 );
+            x1 = _mm_xor_si128( x1, x2 );
+
+            return _mm_extract_epi32( x1, 1 );
+        }
+
+        uint32_t crc32Table( uint32_t crc, const unsigned char *data, size_t length )
+        {
+            return crc32Slice16( crc, data, length );
+        }
+
+        uint32_t crc32Clmul( uint32_t crc, const unsigned char *data, size_t length )
+        {
+            if( length >= 64 ){
+                size_t chunk = length & ~static_cast<size_t>( 15 );
+                crc = crc32Fold( crc, data, chunk );
+                data += chunk;
+                length -= chunk;
+            }
+
+            return crc32Slice16( crc, data, length );
+        }
+
+        typedef uint32_t ( *CrcFunction )( uint32_t, const unsigned char*, size_t );
+
+        const ydispatch::Kernel<CrcFunction> crc_kernels[] = {
+            { ydispatch::CpuLevel::SSE41, "pclmul", crc32Clmul },
+            { ydispatch::CpuLevel::SCALAR, "slice16", crc32Table }
+        };
+
+        const ydispatch::Kernel<CrcFunction> *crc_kernel = &crc_kernels[1];
+
+        /**
+         * Picks the kernel when the library is loaded. Until then the table driven kernel is used.
+         */
+        struct Selector{
+            Selector(){ select(); }
+        };
+
+        const Selector selector;
+
+        /**
+         * Multiply two polynomials modulo the crc32 polynomial, in the reflected bit order.
+         */
+        uint32_t multiplyModP( uint32_t a, uint32_t b )
+        {
+            uint32_t product = 0;
+
+            for( uint32_t m = 1u << 31; m; m >>= 1 ){
+
+                if( a & m ){
+                    product ^= b;
+
+                    if( !( a & ( m - 1 ) ) )
+                        break;
+
+                }
+
+                b = b & 1 ? ( b >> 1 ) ^ polynomial : b >> 1;
+            }
+
+            return product;
+        }
+
+        /**
+         * x^(2^n) modulo the crc32 polynomial, for n = 0..63.
+         */
+        struct PowerTable{
+            uint32_t power[64];
+
+            PowerTable()
+            {
+                uint32_t p = 1u << 30;
+
+                for( int n = 0; n < 64; n++ ){
+                    power[n] = p;
+                    p = multiplyModP( p, p );
+                }
+            }
+        };
+
+        const PowerTable power_table;
+
+        /**
+         * x^(8 * bytes) modulo the crc32 polynomial, ie. the operator that appends @p bytes zero bytes to a crc.
+         */
+        uint32_t zeroBytesOperator( uint64_t bytes )
+        {
+            uint32_t p = 1u << 31;
+
+            for( int k = 3; bytes; bytes >>= 1, k++ ){
+
+                if( bytes & 1 )
+                    p = multiplyModP( power_table.power[k & 63], p );
+
+            }
+
+            return p;
+        }
+    }
+
+    uint32_t crc32( uint32_t crc, const void *data, size_t length )
+    {
+        return ~crc_kernel->function( ~crc, static_cast<const unsigned char*>( data ), length );
+    }
+
+    void select()
+    {
+        crc_kernel = ydispatch::choose( crc_kernels );
+    }
+
+    const char* kernel()
+    {
+        return crc_kernel->name;
+    }
+
+    uint32_t crc32_combine( uint32_t crc_a, uint32_t crc_b, uint64_t length_b )
+    {
+        return multiplyModP( zeroBytesOperator( length_b ), crc_a ) ^ crc_b;
+    }
+
+}
@@ -0,0 +1,119 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ycrc32
+ * The namespace for the crc32 engine used by the encoder and decoder.
+ */
+#ifndef YCRC32_YCRC32_H
+#define YCRC32_YCRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ycrc32{
+
+    /**
+     * Update a crc32 with more data. This computes the same crc32 as used by yenc, zip and zlib, and follows the zlib
+     * convention: pass 0 to start a new checksum, and the returned value is the finished checksum of all data so far.
+     *
+     * Depending on the processor, the data is folded with carry-less multiplication (PCLMULQDQ) or processed with
+     * slice-by-16 tables.
+     *
+     * @param crc The crc32 of the preceding data, or 0.
+     *
+     * @param data The data to add to the checksum.
+     *
+     * @param length The number of bytes in @p data.
+     *
+     * @return The crc32 of the preceding data followed by @p data.
+     */
+    uint32_t crc32( uint32_t crc, const void *data, size_t length );
+
+    /**
+     * Calculate the crc32 of two consecutive blocks of data from the crc32 of each block. This takes time logarithmic
+     * in @p length_b, without touching the data, so the crc32 of a multipart file can be derived from its part crcs.
+     *
+     * @param crc_a The crc32 of the first block.
+     *
+     * @param crc_b The crc32 of the second block.
+     *
+     * @param length_b The length of the second block.
+     *
+     * @return The crc32 of the first block followed by the second.
+     */
+    uint32_t crc32_combine( uint32_t crc_a, uint32_t crc_b, uint64_t length_b );
+
+    /**
+     * Pick the fastest crc32 kernel the level set in ydispatch allows. This happens when the library is loaded, and again
+     * whenever ydispatch::setLevel() is called, so there is no need to call it yourself.
+     */
+    void select();
+
+    /**
+     * @return The name of the crc32 kernel in use.
+     */
+    const char* kernel();
+
+    /**
+     * @class Crc32 ycrc32.h
+     *
+     * @brief Accumulates a crc32 over data that arrives in pieces.
+     *
+     * The interface follows boost::crc_32_type, with the addition of combine() for appending a block whose crc32
+     * is already known.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Crc32
+    {
+        public:
+            Crc32() : value( 0 ), length( 0 ){}
+
+            /**
+             * Add data to the checksum.
+             */
+            void process_bytes( const void *data, size_t size ){ value = crc32( value, data, size ); length += size; }
+
+            /**
+             * Add a block of data to the checksum, given only its crc32 and length.
+             */
+            void combine( uint32_t crc, uint64_t size ){ value = crc32_combine( value, crc, size ); length += size; }
+
+            /**
+             * @return The crc32 of all the data added since construction or the last reset().
+             */
+            uint32_t checksum() const { return value; }
+
+            /**
+             * @return The number of bytes added since construction or the last reset().
+             */
+            uint64_t size() const { return length; }
+
+            void reset(){ value = 0; length = 0; }
+
+        private:
+            uint32_t value;
+            uint64_t length;
+    };
+
+}
+
+#endif
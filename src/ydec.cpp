@@ -18,8 +18,13 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <iomanip>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
 #include "ydecoder.h"
+#include "ysession.h"
+#include "ystats.h"
 
 using namespace ydecoder;
 
@@ -28,19 +33,49 @@ void print( string message )
     cout << message << endl;
 }
 
-int main( int argc, char *argv[] )
+void finished( string name, DecoderStatus::Status status )
 {
-    if( argc < 2 )
-        return EXIT_FAILURE;
+    cout << name << ( status == DecoderStatus::SUCCESS ? " : ok" : " : damaged" ) << endl;
+}
+
+void printStats()
+{
+    ystats::Stats stats = ystats::global();
+    cerr << fixed << setprecision( 1 )
+         << "articles     : " << stats.articles << " (" << stats.parts << " parts)" << endl
+         << "bytes in     : " << stats.bytes_in << endl
+         << "bytes out    : " << stats.bytes_out << endl
+         << "lines        : " << stats.lines << endl
+         << "escapes      : " << stats.escapes << " (" << stats.escapeRatio() * 100 << "%)" << endl
+         << "crc errors   : " << stats.crc_mismatches << endl
+         << "size errors  : " << stats.size_mismatches << endl
+         << "failures     : " << stats.failures << endl
+         << "header time  : " << stats.header_ns / 1e6 << " ms" << endl
+         << "decode time  : " << stats.decode_ns / 1e6 << " ms (" << stats.decodeSpeed() << " MB/s)" << endl
+         << "write time   : " << stats.write_ns / 1e6 << " ms" << endl;
+}
+
+int decode( const vector<string> &inputs, int threads )
+{
+    //With -j N the inputs are decoded as a batch of independent files on N threads
+    if( threads > 0 ){
+        ysession::DecodeSession session( get_current_dir_name(), threads );
+        session.finished.connect( sigc::ptr_fun( finished ) );
+        session.warning.connect( sigc::ptr_fun( print ) );
+        session.error.connect( sigc::ptr_fun( print ) );
+        session.add( inputs );
+        return session.run() == DecoderStatus::SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     YDecoder decoder;
     decoder.message.connect( sigc::ptr_fun( print ) );
     decoder.warning.connect( sigc::ptr_fun( print ) );
     decoder.error.connect( sigc::ptr_fun( print ) );
     decoder.debug.connect( sigc::ptr_fun( print ) );
+    decoder.setInputMode( InputMode::MAPPED );
 
-    for( int i = 1; i < argc; i++ ){
-        decoder.decode( string( argv[i] ) );
+    for( size_t i = 0; i < inputs.size(); i++ ){
+        decoder.decode( inputs[i] );
 }
 
     if( !decoder.write( get_current_dir_name() ) ){
@@ -50,3 +85,40 @@ int main( int argc, char *argv[] )
 
     return EXIT_SUCCESS;
 }
+
+int main( int argc, char *argv[] )
+{
+    vector<string> inputs;
+    int threads = 0;
+    //--stats prints the performance counters of the decoders once everything is decoded
+    bool stats = false;
+
+    //The options can go anywhere among the input files
+    for( int i = 1; i < argc; i++ ){
+
+        if( strcmp( argv[i], "--stats" ) == 0 ){
+            stats = true;
+        }else if( strcmp( argv[i], "-j" ) == 0 ){
+
+            if( ++i == argc || atoi( argv[i] ) < 1 ){
+                print( "-j needs a number of threads" );
+                return EXIT_FAILURE;
+            }
+
+            threads = atoi( argv[i] );
+        }else{
+            inputs.push_back( argv[i] );
+        }
+
+    }
+
+    if( inputs.empty() )
+        return EXIT_FAILURE;
+
+    int result = decode( inputs, threads );
+
+    if( stats )
+        printStats();
+
+    return result;
+}
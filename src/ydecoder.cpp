@@ -18,95 +18,548 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <errno.h>
+#include <fstream>
 #include <iostream>
-#include <boost/format.hpp>
+#include <unistd.h>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/cerrno.hpp>
-#include <boost/algorithm/string/trim.hpp>
 #include "ydecoder.h"
+#include "ydiag.h"
+#include "yfile.h"
+#include "yheader.h"
+#include "yio.h"
+#include "yjournal.h"
+#include "ykernel.h"
+#include "ypipeline.h"
+#include "ythreadpool.h"
 
 using namespace boost::filesystem;
 using namespace ydecoder;
 
+namespace{
+
+    /**
+    * The size of the blocks the data is written out in once it no longer fits within the memory limit.
+    */
+    const size_t block_size = 1 << 20;
+
+    /**
+    * The size of the buffer the input files are read through by the stream based decoding.
+    */
+    const size_t stream_buffer_size = 1 << 16;
+
+    /**
+    * Find the end of the line starting at @p begin.
+    *
+    * @return The position of the linefeed ending the line, or @p end if the line isn't terminated.
+    */
+    inline const char* lineEnd( const char *begin, const char *end )
+    {
+        const char *eol = static_cast<const char*>( memchr( begin, '\n', end - begin ) );
+        return eol ? eol : end;
+    }
+
+    inline bool startsWith( const char *begin, const char *end, const char *prefix )
+    {
+        size_t len = strlen( prefix );
+        return static_cast<size_t>( end - begin ) >= len && memcmp( begin, prefix, len ) == 0;
+    }
+
+    /**
+    * Check whether the line from @p begin to @p eol is the line holding a single dot that terminates an NNTP response.
+    */
+    inline bool isTerminator( const char *begin, const char *eol )
+    {
+        return begin < eol && *begin == '.' && ( eol - begin == 1 || ( eol - begin == 2 && begin[1] == '\r' ) );
+    }
+
+    /**
+    * Find the line that terminates an NNTP response, starting with the line at @p text.
+    *
+    * @return The position just after the terminating line, or @p end if there isn't one.
+    */
+    const char* skipTerminator( const char *text, const char *end )
+    {
+        for( const char *eol; text < end; text = eol + 1 ){
+            eol = lineEnd( text, end );
+
+            if( isTerminator( text, eol ) )
+                return eol < end ? eol + 1 : end;
+
+        }
+
+        return end;
+    }
+
+    /**
+    * Check whether there is any data left to decode once the output buffer is full, rather than just line endings.
+    */
+    bool hasData( const unsigned char *src, const unsigned char *end, bool escape )
+    {
+        while( src < end ){
+            unsigned char scratch[64];
+            size_t chunk = min( static_cast<size_t>( end - src ), sizeof( scratch ) );
+
+            if( ykernel::decode( src, chunk, scratch, escape ) )
+                return true;
+
+            src += chunk;
+        }
+
+        return false;
+    }
+
+    /**
+    * Work out the line endings of the data of an article. The data is only decoded as LF if the line just before it and
+    * its last line end on a bare linefeed, and there is no carriage return anywhere in it. Otherwise it is decoded as
+    * CRLF, which removes every kind of line ending, so data that mixes them still decodes.
+    */
+    ykernel::LineEnding::Style lineEnding( const char *body, const char *body_end )
+    {
+        if( body_end - body < 2 || body[-1] != '\n' || body_end[-1] != '\n' || body[-2] == '\r' || body_end[-2] == '\r' )
+            return ykernel::LineEnding::CRLF;
+
+        //A carriage return is never part of the encoded data, so a single one means a line ending to remove
+        if( memchr( body, '\r', body_end - body ) )
+            return ykernel::LineEnding::CRLF;
+
+        return ykernel::LineEnding::LF;
+    }
+
+    /**
+    * Add the outcome of an article to the counts of @p stats, as one article with a status of @p status.
+    */
+    void countArticle( DecoderStatus::Status status, uint64_t part, ystats::Stats &stats )
+    {
+        stats.articles = 1;
+        stats.parts = part != 0;
+        stats.crc_mismatches = ( status & ( DecoderStatus::CRC_MISMATCH | DecoderStatus::PART_CRC_MISMATCH ) ) != 0;
+        stats.size_mismatches = ( status & DecoderStatus::SIZE_MISMATCH ) != 0;
+        stats.failures = ( status & DecoderStatus::FAILED ) != 0;
+    }
+
+    /**
+    * Add the encoded and decoded data of an article held in memory to the counts of @p stats. Every byte of the data that
+    * is neither a line ending nor accounted for by a decoded byte is an escape character.
+    */
+    void countData( const DecodeResult &result, const char *body, const char *body_end, ystats::Stats &stats )
+    {
+        stats.bytes_in = body_end - body;
+        stats.bytes_out = result.length;
+
+        if( result.lines ){
+            uint64_t line_endings = result.lines * ( lineEnding( body, body_end ) == ykernel::LineEnding::LF ? 1 : 2 );
+            stats.lines = result.lines;
+            stats.escapes = stats.bytes_in - min( stats.bytes_in, line_endings + stats.bytes_out );
+        }
+
+    }
+
+    /**
+    * The state of one part while decoding a multipart file in parallel.
+    */
+    struct PartJob{
+        yfile::MappedFile mapping;
+        vector<char> article;
+        vector<char> output;
+        DecodeResult result;
+        ystats::Stats sample;
+        const char *input, *body, *body_end;
+        size_t input_length;
+        bool opened, written, stored, resumed;
+    };
+
+    /**
+    * Find the range of the file an article holds, counting from 1. A single part article holds the whole file.
+    */
+    inline void partRange( const DecodeResult &result, uint64_t &begin, uint64_t &end )
+    {
+        begin = result.part ? result.begin : 1;
+        end = result.part ? result.end : result.size;
+    }
+
+    /**
+    * Read the values of a \c =ybegin line into @p result.
+    */
+    void parseBeginLine( const char *text, const char *eol, DecodeResult &result )
+    {
+        yheader::YencHeader header;
+        yheader::parseBegin( text, eol, header );
+        result.line = header.line;
+        result.size = header.size;
+        result.part = header.part;
+        result.total = header.total;
+        result.name = header.name.data();
+        result.name_length = header.name.size();
+    }
+
+    /**
+    * Read the values of a \c =ypart line into @p result.
+    */
+    void parsePartLine( const char *text, const char *eol, DecodeResult &result )
+    {
+        yheader::YencHeader header;
+        yheader::parsePart( text, eol, header );
+        result.begin = header.begin;
+        result.end = header.end;
+    }
+
+    /**
+    * Read the values of a \c =yend line into @p result, and check the part number against the header.
+    */
+    void parseEndLine( const char *text, const char *eol, DecodeResult &result )
+    {
+        yheader::YencTrailer trailer;
+        yheader::parseEnd( text, eol, trailer );
+        result.trailer_size = trailer.size;
+        result.crc = trailer.crc;
+        result.pcrc = trailer.pcrc;
+
+        if( result.part && result.part != trailer.part )
+            result.status |= DecoderStatus::PART_MISMATCH;
+
+    }
+
+    /**
+    * Check the decoded data of an article against the values found in its header and trailer, and set the
+    * corresponding flags in the status of @p result.
+    */
+    void verifyResult( DecodeResult &result )
+    {
+        if( result.part ){
+            uint64_t expected = result.end >= result.begin ? result.end - result.begin + 1 : 0;
+
+            if( result.trailer_size != expected || result.length != expected )
+                result.status |= DecoderStatus::SIZE_MISMATCH;
+
+            if( result.pcrc && result.pcrc != result.checksum )
+                result.status |= DecoderStatus::PART_CRC_MISMATCH;
+
+        }else{
+
+            if( result.trailer_size != result.size || result.length != result.size )
+                result.status |= DecoderStatus::SIZE_MISMATCH;
+
+            if( result.crc && result.crc != result.checksum )
+                result.status |= DecoderStatus::CRC_MISMATCH;
+
+        }
+    }
+
+    /**
+    * Reads a file into the blocks of a pipeline, for the thread that feeds it. The data read but not yet handed over
+    * always starts at the read position of the current block, so the lines of a header can be parsed in place, and the
+    * data of an article is handed over without being copied.
+    */
+    class BlockReader
+    {
+        public:
+            BlockReader( int fd, ypipeline::Pipeline &pipeline )
+                : fd( fd ), pipeline( pipeline ), block( pipeline.acquire() ), position( 0 ), filled( 0 ), eof( false ),
+                  error( 0 )
+            {
+            }
+
+            ~BlockReader()
+            {
+                pipeline.release( block );
+            }
+
+            /**
+            * @return The start of the data that hasn't been handed over yet.
+            */
+            const char* begin() const { return block->buffer.data() + position; }
+
+            /**
+            * @return The end of the data read so far.
+            */
+            const char* end() const { return block->buffer.data() + filled; }
+
+            /**
+            * @return \b true once the end of the file has been read, or reading it failed.
+            */
+            bool finished() const { return eof; }
+
+            /**
+            * @return The errno value of the read that failed, or 0.
+            */
+            int failure() const { return error; }
+
+            /**
+            * Fill the block, moving the data that hasn't been handed over to the start of it first.
+            *
+            * @return \b true if anything was read.
+            */
+            bool more()
+            {
+                char *buffer = block->buffer.data();
+                size_t capacity = block->buffer.size();
+                size_t before;
+
+                if( position ){
+                    memmove( buffer, buffer + position, filled - position );
+                    filled -= position;
+                    position = 0;
+                }
+
+                for( before = filled; filled < capacity && !eof; ){
+                    ssize_t count = read( fd, buffer + filled, capacity - filled );
+
+                    if( count > 0 ){
+                        filled += count;
+                    }else if( count == 0 || errno != EINTR ){
+                        error = count ? errno : 0;
+                        eof = true;
+                    }
+
+                }
+
+                return filled > before;
+            }
+
+            /**
+            * Find the end of the line starting @p offset bytes after begin(), reading more of the file until the whole
+            * line is in the block. A line that doesn't fit in a block, or isn't terminated before the end of the file, is
+            * cut short at end(). As the data may be moved, pointers from before the call are no longer valid after it.
+            *
+            * @return The position of the linefeed ending the line, or end() if the line isn't terminated.
+            */
+            const char* line( size_t offset = 0 )
+            {
+                for( ;; ){
+                    const char *eol = lineEnd( begin() + min( offset, static_cast<size_t>( filled - position ) ), end() );
+
+                    if( eol < end() || !more() )
+                        return eol;
+
+                }
+            }
+
+            /**
+            * Skip the data up to @p to.
+            */
+            void skip( const char *to )
+            {
+                position = min( static_cast<size_t>( to - block->buffer.data() ), filled );
+            }
+
+            /**
+            * Hand the data up to @p cut over to the pipeline as data of @p article, and carry the rest over into a new
+            * block.
+            *
+            * @param last Set if @p cut is the end of the data of the article.
+            */
+            void submit( const char *cut, ypipeline::Article &article, bool last )
+            {
+                ypipeline::Block *next = pipeline.acquire();
+                size_t end_offset = cut - block->buffer.data();
+                memcpy( next->buffer.data(), cut, filled - end_offset );
+                block->begin = position;
+                block->end = end_offset;
+                block->article = &article;
+                block->last = last;
+                pipeline.submit( block );
+                block = next;
+                filled -= end_offset;
+                position = 0;
+            }
+
+        private:
+            int fd;
+            ypipeline::Pipeline &pipeline;
+            ypipeline::Block *block;
+            size_t position, filled;
+            bool eof;
+            int error;
+
+            BlockReader( const BlockReader& );
+            BlockReader& operator=( const BlockReader& );
+    };
+
+    /**
+    * Find where the data in a full block can be cut off so the rest can be carried over to the next block. The cut
+    * leaves out anything that could be the start of a trailer line, and lies just after a byte that is neither an
+    * escape character nor a line ending, so the escape state at the cut is clear and the next block can be decoded on
+    * its own.
+    *
+    * @return The position to cut at, or @p text if there is no such position.
+    */
+    const char* blockCut( const char *text, const char *end )
+    {
+        static const char trailer[] = "\n=yend";
+        const char *cut = end;
+
+        for( size_t n = min( static_cast<size_t>( end - text ), sizeof( trailer ) - 2 ); n; n-- ){
+
+            if( memcmp( end - n, trailer, n ) == 0 ){
+                cut = end - n;
+                break;
+            }
+
+        }
+
+        while( cut > text && ( cut[-1] == '=' || cut[-1] == '\r' || cut[-1] == '\n' ) )
+            cut--;
+
+        return cut;
+    }
+}
+
 YDecoder::YDecoder()
-    : crc( 0 ), line( 0 ), name( NULL ), part( 0 ), part_size( 0 ), pcrc( 0 ),
-    size( 0 ), total_parts( 0), escaped( 64 ), magic( 42 )
+    : escaped( 64 ), magic( 42 ), crc( 0 ), pcrc( 0 ), part_crc_bytes( 0 ), line( 0 ), output_buffer( &own_buffers ),
+    stream_buffer( &own_buffers ), headers( &own_buffers ), part( 0 ), part_begin( 0 ), part_size( 0 ), size( 0 ),
+    total_parts( 0 ), threads( 0 ), pool( NULL ), io( NULL ), journal( NULL ), pipeline( NULL ), journaling( false ),
+    output_fd( -1 ), input_mode( InputMode::STREAM ), article_format( ArticleFormat::PLAIN ), memory_limit( 0 ),
+    spilled( false )
 {
 }
 
 YDecoder::~YDecoder()
 {
+    closeOutput();
+    delete pipeline;
+    delete pool;
+    delete io;
+    delete journal;
 }
 
 void YDecoder::initialize()
 {
     crc = 0;
     crc_val.reset();
+    part_crcs.clear();
+    part_crc_bytes = 0;
     line = 0;
-    delete name;
-    name = NULL;
+    headers.reset();
+    name.clear();
     part = 0;
+    part_begin = 0;
     pcrc_val.reset();
     part_size = 0;
     pcrc = 0;
     size = 0;
     total_parts = 0;
+    data.clear();
+    closeOutput();
 }
 
 DecoderStatus::Status YDecoder::decode( const string &input, const DecodingOption::Option &decoding )
 {
-    filesystem::ifstream in( input );
+    if( input_mode == InputMode::MAPPED || ( journaling && !output_directory.empty() ) )
+        return decodeMapped( input, decoding );
+
+    if( input_mode == InputMode::PIPELINED )
+        return decodePipelined( input, decoding );
+
+    //Read through a buffer from the pool, so the stream doesn't allocate one of its own for every file, and open the file
+    //by its name as it is, as converting it to a path allocates too
+    std::ifstream in;
+    char *buffer = stream_buffer.reserve( stream_buffer_size );
+
+    if( buffer )
+        in.rdbuf()->pubsetbuf( buffer, stream_buffer.capacity() );
+
+    in.open( input.c_str() );
 
     if( !in.is_open() ){
-        error.emit( str( format( "Failed to open file %1%" ) % input ) );
+        YENC_ERROR( error, "Failed to open file %s", input.c_str() );
         return DecoderStatus::FAILED;
     }
 
-    stringstream write_buffer;
     DecoderStatus::Status status = DecoderStatus::SUCCESS;
+    ystats::Stopwatch watch;
 
     while( getline( in, read_buffer ) ){
 
-        if( read_buffer.substr( 0, 8 ) != "=ybegin " )
+        if( read_buffer.compare( 0, 8, "=ybegin " ) != 0 )
             continue;
 
-        if( ( status = parseHeader( &in ) ) != DecoderStatus::SUCCESS ){
-            error.emit( "Failed to parse header!" );
+        ystats::Stats sample;
+
+        if( ( status = parseHeader( &in, decoding ) ) != DecoderStatus::SUCCESS ){
+            YENC_ERROR( error, "Failed to parse header!" );
 
             if( decoding == DecodingOption::STRICT )
             break;
         }
 
-        string::iterator iter;
+        if( !output_directory.empty() && output_fd < 0 && !openOutput() ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        if( output_fd < 0 && !fitsInMemory( data.size() + part_size ) && !startSpill() ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        //Decode straight onto the end of the file data, unless it is written to disk part by part
+        string &target = output_fd < 0 ? data : write_buffer;
+        size_t offset = output_fd < 0 ? data.size() : 0;
+        size_t length = 0;
+        uint64_t written = 0;
+        uint64_t part_offset = part && part_begin ? part_begin - 1 : 0;
+        bool blocks = output_fd >= 0 && !fitsInMemory( part_size );
+        bool write_failed = false;
+        uint32_t part_crc = 0;
+        bool escape = false;
+        write_buffer.clear();
+        sample.header_ns = watch.lap();
+
+        //getline has already split off the linefeeds, so the lines are decoded without looking for line endings
+        const ykernel::SpanDecoder decode_line = ykernel::decoder( ykernel::LineEnding::NONE, true );
 
         //The data read in this loop is the actual encoded file data
         while( getline( in, read_buffer ) ){
 
-            if( read_buffer.substr( 0, 5 ) == "=yend" ){
+            if( read_buffer.compare( 0, 5, "=yend" ) == 0 )
                 break;
-            }else{
-                for( iter = read_buffer.begin(); iter < read_buffer.end(); iter++ ){
 
-                    if( *iter == '\r' || *iter == '\n' )
-                        continue;
+            size_t line_length = read_buffer.length();
+
+            if( line_length && read_buffer[line_length - 1] == '\r' )
+                line_length--;
+
+            //Decoding never produces more bytes than it consumes, so this is enough room for the line
+            target.resize( offset + length + line_length );
+            size_t produced = decode_line( reinterpret_cast<const unsigned char*>( read_buffer.data() ), line_length,
+                                           reinterpret_cast<unsigned char*>( &target[offset + length] ), escape, part_crc );
+            length += produced;
+            sample.bytes_in += read_buffer.length() + 1;
+            sample.lines++;
+            sample.escapes += line_length - produced;
+
+            //A part that doesn't fit within the memory limit is written out as it is decoded
+            if( blocks && length >= block_size ){
+                sample.decode_ns += watch.lap();
+                write_failed |= !yfile::writeAt( output_fd, write_buffer.data(), length, part_offset + written );
+                sample.write_ns += watch.lap();
+                written += length;
+                length = 0;
+            }
+        }
 
-                    if( *iter == '=' ){
-                        iter++;
-                        *iter -= escaped;
-                    }
+        target.resize( offset + length );
+        pcrc_val.combine( part_crc, written + length );
+        addPartCrc( output_fd < 0 ? offset : part_offset, part_crc, written + length );
+        sample.decode_ns += watch.lap();
+        status = parseTrailer( written + length, decoding );
+        pcrc_val.reset();
+        sample.header_ns += watch.lap();
 
-                    *iter -= magic;
-                    write_buffer << *iter;
-                }
-            }
+        if( output_fd >= 0 && ( blocks || !( status & DecoderStatus::PART_CRC_MISMATCH ) || decoding == DecodingOption::FORCE ) )
+            write_failed |= !yfile::writeAt( output_fd, write_buffer.data(), length, part_offset + written );
 
+        if( write_failed ){
+            YENC_ERROR( error, "Failed to write part %llu : %s", static_cast<unsigned long long>( part ), strerror( errno ) );
+            status |= DecoderStatus::FAILED;
         }
 
-        data << write_buffer.str() ;
-        crc_val.process_bytes( write_buffer.str().c_str(), write_buffer.str().length() );
-        pcrc_val.process_bytes( write_buffer.str().c_str(), write_buffer.str().length() );
-        status = parseTrailer( write_buffer );
-        pcrc_val.reset();
+        sample.write_ns += watch.lap();
+        sample.bytes_out = written + length;
+        countArticle( status, part, sample );
+        counters.add( sample );
     }
 
     in.close();
@@ -114,248 +567,1988 @@ DecoderStatus::Status YDecoder::decode( const string &input, const DecodingOptio
 
 }
 
-DecoderStatus::Status decode( const vector<string>& input, const DecodingOption::Option &decoding )
+DecoderStatus::Status YDecoder::decode( const vector<string>& input, const DecodingOption::Option &decoding )
 {
-}
+    vector<PartJob> jobs( input.size() );
+    DecoderStatus::Status status = DecoderStatus::SUCCESS;
 
-/**
-* Function for obtaining values of parameters from the header and trailer of a yenc encoded file.
-* The return value is only valid immediately after this call returns, so do not under any
-* circumstances assign pointers to this value. Rather, copy the value into a variable of your choice.
-*
-* @param attr The name of the parameter that you wish to obtain a value for.
-*
-* @return The associated value of the parameter @p attr. NULL is returned is the parameter was not found.
-*
-* @warning This function should not be used to retrieve the name parameter. Use the function YDecoder::getName()
-* for that.
-*
-* @sa getName()
-*/
-const char* YDecoder::getAttribute( const char *attr )
-{
-    int pos = read_buffer.find( attr );
+    bool limited = memory_limit;
+    bool mapped = input_mode == InputMode::MAPPED || limited;
+    vector<int> errors( jobs.size(), 0 );
 
-    if( pos ){
-        const char *text = read_buffer.c_str();
-        int skip = pos + strlen( attr ) + 1;
+    if( !pool )
+        pool = new ythreadpool::ThreadPool( threads );
 
-        while( skip ){
-            *text++;
-            skip--;
-        }
+    if( !io )
+        io = new yio::IoEngine;
+
+    //Read all the parts in one go, so the reads are batched into as few system calls as possible
+    if( !mapped ){
+        vector<vector<char> > contents;
+        io->readFiles( input, contents, errors );
+
+        for( size_t i = 0; i < jobs.size(); i++ )
+            jobs[i].article.swap( contents[i] );
 
-        return text;
     }
 
-    return NULL;
-}
+    //Find the headers of the parts, so we know where each part goes before decoding any of them
+    for( size_t i = 0; i < jobs.size(); i++ ){
+        PartJob *job = &jobs[i];
+        job->body = NULL;
+        job->opened = !mapped && !errors[i];
+        pool->schedule( [job, &input, i, mapped, limited, &decoding]{
+            ystats::Stopwatch watch;
 
-/**
-* Retrieve the filename the decoded data should be written to. If this function returns NULL, then
-* the decoder should abort.
-*
-* @return The filename that the decoded data should be written to. Returns NULL if nothing was found.
-*
-* @sa getAttribute()
-*/
-char* YDecoder::getName()
-{
-    int pos = read_buffer.find( "name" );
+            if( mapped ){
+
+                if( ( job->opened = job->mapping.map( input[i] ) ) ){
+                    job->input = job->mapping.data();
+                    job->input_length = job->mapping.size();
+                }
+
+            }else if( job->opened ){
+                job->input = job->article.data();
+                job->input_length = job->article.size();
+            }
+
+            if( job->opened )
+                job->body = scanArticle( job->input, job->input_length, decoding, job->result, &job->body_end,
+                                         limited ? &job->mapping : NULL );
+
+            job->sample.header_ns = watch.lap();
+        } );
+    }
+
+    pool->wait();
+    vector<PartJob*> parts;
+
+    for( size_t i = 0; i < jobs.size(); i++ ){
+        PartJob &job = jobs[i];
+
+        if( !job.opened || !job.body ){
 
-    if( pos ){
-        const char *text = read_buffer.c_str();
-        int skip = pos + 5;
+            if( !job.opened )
+                YENC_ERROR( error, "Failed to open file %s", input[i].c_str() );
+            else
+                YENC_ERROR( error, "Failed to parse header of %s", input[i].c_str() );
 
-        while( skip ){
-            *text++;
-            skip--;
+            status |= DecoderStatus::FAILED;
+            continue;
+        }
+
+        if( name.empty() ){
+            name = headers.copy( job.result.name, job.result.name_length );
+            size = job.result.size;
+            line = job.result.line;
+            total_parts = job.result.total;
+        }else if( name != boost::string_view( job.result.name, job.result.name_length ) ){
+            YENC_WARNING( warning, "%s belongs to a different file, skipping", input[i].c_str() );
+            status |= DecoderStatus::NAME_MISMATCH;
+            continue;
         }
 
-        stringstream stream;
+        //A single part article holds the whole file
+        if( !job.result.part ){
+            job.result.begin = 1;
+            job.result.end = job.result.size;
+        }
 
-        while( !( *text == '\r' || *text == '\n' ) ){
-            stream << *text;
-            *text++;
+        if( !job.result.begin || job.result.end < job.result.begin || job.result.end > size ){
+            YENC_ERROR( error, "Invalid part range in %s", input[i].c_str() );
+            status |= DecoderStatus::FAILED;
+            continue;
         }
 
-        string name = stream.str();
-        trim( name );
-        int len = name.length() + 1;
-        char *m_name = new char[len];
-        strcpy( m_name, name.c_str() );
-        debug.emit( str( format( "Found name : %1%" ) % m_name ) );
-        return m_name;
+        parts.push_back( &job );
     }
 
-    warning.emit( "Failed to find name!" );
-    return NULL;;
-}
+    if( ( status & DecoderStatus::FAILED ) && decoding == DecodingOption::STRICT )
+        return status;
 
-/**
-* Parses the header data in a yencoded file. Call this function when the line beginning with \c =ybegin
-* followed by a whitespace has been read, as per the yenc specifications. All header variables are set
-* after this function has been called. The filestream passed to the function is garuanteed to point to the
-* beginning of the yencoded data after this function has been called.
-*
-* @param in The filestream that the function should read from.
-*
-* @return @b true if the header variables line, size and name were set, otherwise @b false
-*
-* @sa parseHeader()
-*/
-DecoderStatus::Status YDecoder::parseHeader( filesystem::ifstream *in, const DecodingOption::Option &decoding )
-{
-    //Read the yEnc header
-    part = atoi( getAttribute( "part" ) );
-    debug.emit( str( format( "part : %1%" ) % part ) );
-    line = atoi( getAttribute( "line" ) );
-    debug.emit( str( format( "line : %1%" ) % line ) );
-    size = atoi( getAttribute( "size" ) );
-    debug.emit( str( format( "size : %1%" ) % size ) );
-
-    if( !name ){
-        name = getName();
-    }else{
+    sort( parts.begin(), parts.end(), []( const PartJob *a, const PartJob *b ){ return a->result.begin < b->result.begin; } );
 
-        if( strcmp( name, getName() ) != 0 ){
-            warning.emit( "Name mismatch!" );
-            return DecoderStatus::NAME_MISMATCH;
+    //Overlapping parts would be decoded into the same memory by different threads
+    for( size_t i = 1; i < parts.size(); ){
+
+        if( parts[i]->result.begin <= parts[i - 1]->result.end ){
+            YENC_WARNING( warning, "Part %llu overlaps part %llu, skipping", static_cast<unsigned long long>( parts[i]->result.part ),
+                          static_cast<unsigned long long>( parts[i - 1]->result.part ) );
+            status |= DecoderStatus::SIZE_MISMATCH;
+            parts.erase( parts.begin() + i );
+        }else{
+            i++;
         }
-    }
 
-    //If the part variable was set we are dealing with a multipart file
-    if( part ){
-        getline( *in, read_buffer );
-        int begin = atoi( getAttribute( "begin" ) );
-        int end = atoi( getAttribute( "end" ) );
-        part_size = ( end - begin ) + 1;
-        debug.emit( str( format( "part size : %1%" ) % part_size ) );
-        total_parts = atoi( getAttribute( "total" ) );
-        debug.emit( str( format( "total parts : %1%" ) % total_parts ) );
     }
 
-    if( !( line && size && name ) ){
-        error.emit( "Unable to find all required header variables!" );
-        return DecoderStatus::FAILED;
+    //With FORCE the parts that couldn't be read are skipped, which may leave nothing to decode
+    if( parts.empty() || name.empty() ){
+        YENC_ERROR( error, "No articles to decode!" );
+        status |= DecoderStatus::FAILED;
+        return status;
     }
 
-    return DecoderStatus::SUCCESS;
+    if( !output_directory.empty() ){
 
-}
+        if( output_fd < 0 && !openOutput() ){
+            status |= DecoderStatus::FAILED;
+            return status;
+        }
 
-/**
-* Parse the trailer of the yencoded file. Call this function when the line beginning with \c =yend has been read.
-* This function should only be called \em after all the data has been read and the final CRC value has been
-* calculated for the decoded data.
-* @return The status of the decoder.
-*/
-DecoderStatus::Status YDecoder::parseTrailer( const stringstream &write_stream, const DecodingOption::Option &decoding )
-{
-    DecoderStatus::Status status = DecoderStatus::SUCCESS;
-    if( part ){
+    }else if( output_fd < 0 && !growData( size ) ){
+        status |= DecoderStatus::FAILED;
+        return status;
+    }
 
-        if( part != atoi( getAttribute( "part" ) ) )
-            status = static_cast<DecoderStatus::Status>( status | DecoderStatus::PART_MISMATCH );
+    for( size_t i = 0; i < parts.size(); i++ ){
+        PartJob *job = parts[i];
+        job->written = true;
+        job->stored = false;
+
+        //A part the journal says an earlier run has written is left as it is
+        if( ( job->resumed = resumePart( job->result ) ) ){
+            YENC_DEBUG( debug, "Part %llu is already written, skipping", static_cast<unsigned long long>( job->result.part ) );
+            verifyResult( job->result );
+            vector<char>().swap( job->article );
+            job->mapping.unmap();
+            continue;
+        }
 
-        if( decoding == DecodingOption::STRICT )
-            return status;
+        size_t capacity = job->result.end - job->result.begin + 1;
+        bool blocks = output_fd >= 0 && !fitsInMemory( capacity );
+        char *output;
+        int fd = output_fd;
+
+        //When writing to disk, a part that was read into memory is decoded in place, and a mapped part into a buffer of its
+        //own, which is freed once it has been written
+        if( fd < 0 ){
+            output = &data[job->result.begin - 1];
+        }else if( !blocks && !job->article.empty() ){
+            output = job->article.data() + ( job->body - job->article.data() );
+        }else{
+            job->output.resize( blocks ? block_size : capacity );
+            output = job->output.data();
+        }
 
-        if( part_size != atoi( getAttribute( "size" ) ) )
-            status = static_cast<DecoderStatus::Status>( status | DecoderStatus::SIZE_MISMATCH );
+        yio::IoEngine *engine = io;
+        pool->schedule( [job, output, capacity, fd, blocks, engine, &decoding]{
+            ystats::Stopwatch watch;
+            uint64_t write_time = 0;
+            bool queued = false;
+
+            if( blocks )
+                job->written = decodeBlocks( job->body, job->body_end, fd, job->result.begin - 1, capacity, job->output.data(),
+                                             job->result, write_time, &job->mapping );
+            else
+                decodeBody( job->body, job->body_end, output, capacity, job->result );
+
+            job->sample.decode_ns = watch.lap() - write_time;
+            job->sample.write_ns = write_time;
+            countData( job->result, job->body, job->body_end, job->sample );
+            verifyResult( job->result );
+            job->stored = fd >= 0 && ( blocks || !( job->result.status & DecoderStatus::PART_CRC_MISMATCH ) || decoding == DecodingOption::FORCE );
+
+            if( job->stored && !blocks ){
+                //All the parts that were read are in memory until the end anyway, so their writes can be left to the engine
+                queued = !job->article.empty();
+
+                if( queued )
+                    engine->write( fd, output, job->result.length, job->result.begin - 1 );
+                else
+                    job->written = yfile::writeAt( fd, output, job->result.length, job->result.begin - 1 );
 
-        if( decoding == DecodingOption::STRICT )
-            return status;
+            }
 
-        if( part_size != write_stream.str().length() )
-            status = static_cast<DecoderStatus::Status>( status | DecoderStatus::SIZE_MISMATCH );
+            job->sample.write_ns += watch.lap();
 
-        if( decoding == DecodingOption::STRICT )
-            return status;
+            if( !queued )
+                vector<char>().swap( job->article );
 
-        pcrc = strtoul( getAttribute( " pcrc32" ), NULL, 16 );
-        debug.emit( str( format( "pcrc : %1$x" ) % pcrc ) );
+            vector<char>().swap( job->output );
+            job->mapping.unmap();
+        } );
+    }
 
-        if( pcrc != pcrc_val.checksum() ){
-            debug.emit( str( format( "pcrc_val : %1$x" ) % pcrc_val.checksum() ) );
-            warning.emit( "pcrc mismatch!" );
-            status = static_cast<DecoderStatus::Status>( status | DecoderStatus::PART_CRC_MISMATCH );
+    pool->wait();
 
-            if( decoding == DecodingOption::STRICT )
-                return status;
-        }
+    //The writes left to the engine go out all at once, so their time is counted for the whole file
+    ystats::Stopwatch watch;
+    ystats::Stats flushed;
 
+    if( !io->flush() ){
+        YENC_ERROR( error, "Failed to write to %s : %s", string( name.data(), name.size() ).c_str(), strerror( errno ) );
+        status |= DecoderStatus::FAILED;
     }else{
 
-        if( size != atoi( getAttribute( "size" ) ) )
-            status = static_cast<DecoderStatus::Status>( status | DecoderStatus::SIZE_MISMATCH );
+        for( size_t i = 0; i < parts.size(); i++ ){
 
-        if( decoding == DecodingOption::STRICT )
-            return status;
+            if( parts[i]->stored && parts[i]->written )
+                recordPart( parts[i]->result );
+
+        }
 
+        commitJournal();
     }
 
-    crc = strtoul( getAttribute( " crc32" ), NULL, 16 );
-    debug.emit( str( format( "crc : %1$x" ) % crc ) );
+    flushed.write_ns = watch.lap();
+    counters.add( flushed );
+
+    //The parts are sorted by offset, so the file crc follows from the part crcs
+    uint64_t covered = 0;
+    uint32_t file_crc = 0;
+    crc_val.reset();
 
-    if( crc && crc != crc_val.checksum() ){
-        debug.emit( str( format( "crc_val : %1$x" ) % crc_val.checksum() ) );
-        warning.emit( "crc mismatch!" );
-        status = static_cast<DecoderStatus::Status>( status | DecoderStatus::CRC_MISMATCH );
+    for( size_t i = 0; i < parts.size(); i++ ){
+        DecodeResult &result = parts[i]->result;
+        status |= result.status;
+        part = result.part;
 
-        if( decoding == DecodingOption::STRICT )
-            return status;
+        if( result.status & DecoderStatus::PART_CRC_MISMATCH ){
+            YENC_DEBUG( debug, "pcrc : %x, pcrc_val : %x", result.pcrc, result.checksum );
+            YENC_WARNING( warning, "pcrc mismatch in part %llu!", static_cast<unsigned long long>( result.part ) );
+        }
+
+        if( result.status & DecoderStatus::SIZE_MISMATCH )
+            YENC_WARNING( warning, "Size mismatch in part %llu!", static_cast<unsigned long long>( result.part ) );
+
+        DecoderStatus::Status part_status = result.status;
+
+        if( !parts[i]->written ){
+            YENC_ERROR( error, "Failed to write part %llu", static_cast<unsigned long long>( result.part ) );
+            status |= DecoderStatus::FAILED;
+            part_status |= DecoderStatus::FAILED;
+        }
+
+        if( !parts[i]->resumed ){
+            countArticle( part_status, result.part, parts[i]->sample );
+            counters.add( parts[i]->sample );
+        }
+
+        if( result.crc )
+            file_crc = result.crc;
+
+        if( result.begin == covered + 1 ){
+            crc_val.combine( result.checksum, result.length );
+            covered += result.end - result.begin + 1;
+        }
     }
 
+    //The journal holds the parts written by earlier runs as well, so it can cover the file when the parts passed here don't
+    if( covered != size && journalCrc( crc_val ) )
+        covered = size;
+
+    if( covered != size ){
+        YENC_WARNING( warning, "Missing parts!" );
+        status |= DecoderStatus::SIZE_MISMATCH;
+    }else if( file_crc && file_crc != crc_val.checksum() ){
+        YENC_DEBUG( debug, "crc : %x, crc_val : %x", file_crc, crc_val.checksum() );
+        YENC_WARNING( warning, "crc mismatch!" );
+        status |= DecoderStatus::CRC_MISMATCH;
+    }
+
+    crc = file_crc;
     return status;
 }
 
-bool YDecoder::write( const char *path )
+bool YDecoder::setOutputDirectory( const char *path )
 {
-    if( !name ){
-        error.emit( "Unable to write to file : filename not set" );
+    output_directory.clear();
+
+    if( !path )
+        return true;
+
+    if( !checkDirectory( filesystem::path( path ) ) )
         return false;
+
+    output_directory = path;
+    return true;
+}
+
+void YDecoder::setJournal( bool enabled )
+{
+    journaling = enabled;
+}
+
+void YDecoder::setInputMode( const InputMode::Mode &mode )
+{
+    input_mode = mode;
+}
+
+void YDecoder::setArticleFormat( const ArticleFormat::Format &format )
+{
+    article_format = format;
+}
+
+void YDecoder::setThreads( unsigned int count )
+{
+    if( count != threads ){
+        delete pool;
+        pool = NULL;
+        delete pipeline;
+        pipeline = NULL;
+        threads = count;
     }
+}
 
-    filesystem::path p( path );
+void YDecoder::setBufferPool( ybuffer::BufferPool *buffers )
+{
+    if( !buffers )
+        buffers = &own_buffers;
 
-    try{
+    output_buffer.setPool( buffers );
+    stream_buffer.setPool( buffers );
+    headers.setPool( buffers );
+}
 
-        if( !exists( p ) ){
-            warning.emit( str( format( "Directory %1% doesn't exist, creating..." ) % p.native_file_string() ) );
+void YDecoder::setMemoryLimit( uint64_t limit, const char *directory )
+{
+    memory_limit = limit;
+    spill_directory = directory ? directory : "";
+}
 
-            if( !create_directory( p ) ){
-                error.emit( str( format( "Failed to create directory %1%, aborting!" ) % p.native_file_string() ) );
-                return false;
-            }
+DecodeResult YDecoder::decode( const char *input, size_t length, char *output, size_t capacity, const DecodingOption::Option &decoding )
+{
+    DecodeResult result;
+    ystats::Stopwatch watch;
+    ystats::Stats sample;
+    const bool nntp = article_format == ArticleFormat::NNTP;
+    const char *body_end = input + length;
+    const char *body = nntp ? scanHeader( input, length, decoding, result, true )
+                            : scanArticle( input, length, decoding, result, &body_end );
+
+    if( !body ){
+        YENC_ERROR( error, "Failed to parse header!" );
+        return result;
+    }
 
-        }else{
+    sample.header_ns = watch.lap();
 
-            if( !is_directory( p ) ){
-                error.emit( str( format( "%1% is not a directory, aborting!" ) % p.native_file_string() ) );
-                return false;
-            }
+    if( !output ){
+        size_t needed = body_end - body;
 
+        if( !( output = output_buffer.reserve( needed ) ) ){
+            YENC_ERROR( error, "Failed to allocate %llu bytes for the decoded data", static_cast<unsigned long long>( needed ) );
+            return result;
         }
 
-        //Append the current filename to the path
-        p /= name;
-        filesystem::ofstream out( p );
+        capacity = output_buffer.capacity();
+    }
 
-        if( !out.is_open() ){
-            error.emit( str( format( "Failed to open %1% for writing, aborting!" ) % p.native_file_string() ) );
-            return false;
-        }
+    if( !nntp ){
+        decodeBody( body, body_end, output, capacity, result );
+    }else if( !decodeNntp( input, length, body, output, capacity, decoding, result ) ){
+        YENC_ERROR( error, "Failed to find trailer!" );
+        return result;
+    }else{
+        body_end = input + result.consumed;
+    }
 
-        debug.emit( str( format( "Writing data to %1%"  ) % p.native_file_string() ) );
-        out << data.str();
-        out.close();
-        return true;
+    verifyResult( result );
+    sample.decode_ns = watch.lap();
+    countArticle( result.status, result.part, sample );
+    countData( result, body, body_end, sample );
+    counters.add( sample );
+    reportResult( result );
+    return result;
+}
 
-    }catch( filesystem_error &err ){
-        string sys_err;
-        system_message( err.system_error(), sys_err );
-        error.emit( str( format( "Error in writing to file  %1% : %2%") % p.native_file_string() % sys_err ) );
-        return false;
+size_t YDecoder::decodeInPlace( char *buffer, size_t length, DecodeResult &result, const DecodingOption::Option &decoding )
+{
+    ystats::Stopwatch watch;
+    ystats::Stats sample;
+    const bool nntp = article_format == ArticleFormat::NNTP;
+    const char *body_end = buffer + length;
+    const char *body = nntp ? scanHeader( buffer, length, decoding, result, true )
+                            : scanArticle( buffer, length, decoding, result, &body_end );
+
+    if( !body ){
+        YENC_ERROR( error, "Failed to parse header!" );
+        return 0;
+    }
+
+    sample.header_ns = watch.lap();
+
+    //The kernels never write past the input they have read, so the data can be decoded over itself
+    char *output = buffer + ( body - buffer );
+
+    if( !nntp ){
+        decodeBody( body, body_end, output, body_end - body, result );
+    }else if( !decodeNntp( buffer, length, body, output, body_end - body, decoding, result ) ){
+        YENC_ERROR( error, "Failed to find trailer!" );
+        return 0;
+    }else{
+        body_end = buffer + result.consumed;
     }
+
+    verifyResult( result );
+    sample.decode_ns = watch.lap();
+    countArticle( result.status, result.part, sample );
+    countData( result, body, body_end, sample );
+    counters.add( sample );
+    reportResult( result );
+    return result.length;
+}
+
+DecoderStatus::Status YDecoder::decodeBatch( const ArticleSpan *articles, size_t count, BatchResult &results, char *output,
+                                             size_t capacity, const DecodingOption::Option &decoding )
+{
+    DecoderStatus::Status status = DecoderStatus::SUCCESS;
+    const bool nntp = article_format == ArticleFormat::NNTP;
+    ystats::Stopwatch watch;
+    ystats::Stats batch;
+    size_t used = 0;
+
+    results.status.resize( count );
+    results.part.resize( count );
+    results.begin.resize( count );
+    results.end.resize( count );
+    results.crc_ok.resize( count );
+    results.offset.resize( count );
+    results.length.resize( count );
+
+    //Decoding never produces more bytes than it consumes, so the articles together are enough room for all the data
+    if( !output ){
+        size_t needed = 0;
+
+        for( size_t i = 0; i < count; i++ )
+            needed += articles[i].length;
+
+        if( !( output = output_buffer.reserve( needed ) ) ){
+            YENC_ERROR( error, "Failed to allocate %llu bytes for the decoded data", static_cast<unsigned long long>( needed ) );
+            capacity = 0;
+        }else{
+            capacity = output_buffer.capacity();
+        }
+
+    }
+
+    for( size_t i = 0; i < count; i++ ){
+        DecodeResult result;
+        ystats::Stats sample;
+        const char *input = articles[i].data;
+        const char *body_end = input + articles[i].length;
+        const char *body = nntp ? scanHeader( input, articles[i].length, decoding, result, true )
+                                : scanArticle( input, articles[i].length, decoding, result, &body_end );
+        sample.header_ns = watch.lap();
+
+        if( !body || !output ){
+            result.status = DecoderStatus::FAILED;
+        }else if( !nntp ){
+            decodeBody( body, body_end, output + used, capacity - used, result );
+            verifyResult( result );
+        }else if( decodeNntp( input, articles[i].length, body, output + used, capacity - used, decoding, result ) ){
+            body_end = input + result.consumed;
+            verifyResult( result );
+        }
+
+        //A failed article leaves its data behind, to be written over by the next one
+        if( result.status & DecoderStatus::FAILED )
+            result.length = 0;
+
+        if( body ){
+            sample.decode_ns = watch.lap();
+            countArticle( result.status, result.part, sample );
+
+            if( !( result.status & DecoderStatus::FAILED ) )
+                countData( result, body, body_end, sample );
+
+            batch += sample;
+        }
+
+        results.status[i] = result.status;
+        results.part[i] = result.part;
+        results.begin[i] = result.begin;
+        results.end[i] = result.end;
+        results.crc_ok[i] = result.part ? result.pcrc && result.pcrc == result.checksum : result.crc && result.crc == result.checksum;
+        results.offset[i] = used;
+        results.length[i] = result.length;
+        used += result.length;
+        status |= result.status;
+    }
+
+    results.output = output;
+    counters.add( batch );
+    return status;
+}
+
+/**
+* Parses the header data in a yencoded file. Call this function when the line beginning with \c =ybegin
+* followed by a whitespace has been read, as per the yenc specifications. All header variables are set
+* after this function has been called. The filestream passed to the function is garuanteed to point to the
+* beginning of the yencoded data after this function has been called.
+*
+* @param in The filestream that the function should read from.
+*
+* @param decoding With STRICT, a part without a \c =ypart line is treated as a failure. With FORCE, the line after
+* the header is taken to be data.
+*
+* @return @b true if the header variables line, size and name were set, otherwise @b false
+*
+* @sa parseHeader()
+*/
+DecoderStatus::Status YDecoder::parseHeader( istream *in, const DecodingOption::Option &decoding )
+{
+    //Read the yEnc header
+    yheader::YencHeader header;
+    yheader::parseBegin( read_buffer.data(), read_buffer.data() + read_buffer.length(), header );
+
+    if( name.empty() ){
+        name = headers.copy( header.name.data(), header.name.size() );
+    }else if( header.name != name ){
+        YENC_WARNING( warning, "Name mismatch!" );
+        return DecoderStatus::NAME_MISMATCH;
+    }
+
+    part = header.part;
+    line = header.line;
+    size = header.size;
+
+    //If the part variable was set we are dealing with a multipart file
+    if( part ){
+        istream::pos_type data_start = in->tellg();
+        getline( *in, read_buffer );
+
+        if( yheader::parsePart( read_buffer.data(), read_buffer.data() + read_buffer.length(), header ) ){
+            part_begin = header.begin;
+            part_size = header.end >= header.begin ? header.end - header.begin + 1 : 0;
+        }else if( decoding == DecodingOption::STRICT ){
+            YENC_ERROR( error, "Missing part header!" );
+            return DecoderStatus::FAILED;
+        }else{
+            //Without a part header, the line is just data
+            in->seekg( data_start );
+            part_begin = 0;
+            part_size = 0;
+        }
+
+        total_parts = header.total;
+    }else{
+        part_size = size;
+    }
+
+    YENC_DEBUG( debug, "name : %s, part : %llu, line : %llu, size : %llu, part size : %llu, total parts : %llu",
+                string( name.data(), name.size() ).c_str(), static_cast<unsigned long long>( part ),
+                static_cast<unsigned long long>( line ), static_cast<unsigned long long>( size ),
+                static_cast<unsigned long long>( part_size ), static_cast<unsigned long long>( total_parts ) );
+
+    if( !( line && size && !name.empty() ) ){
+        YENC_ERROR( error, "Unable to find all required header variables!" );
+        return DecoderStatus::FAILED;
+    }
+
+    return DecoderStatus::SUCCESS;
+
+}
+
+/**
+* Parse the trailer of the yencoded file. Call this function when the line beginning with \c =yend has been read.
+* This function should only be called \em after all the data has been read and the final CRC value has been
+* calculated for the decoded data.
+*
+* @param length The number of bytes of data that were decoded.
+*
+* @return The status of the decoder.
+*/
+DecoderStatus::Status YDecoder::parseTrailer( uint64_t length, const DecodingOption::Option &decoding )
+{
+    DecoderStatus::Status status = DecoderStatus::SUCCESS;
+    yheader::YencTrailer trailer;
+    yheader::parseEnd( read_buffer.data(), read_buffer.data() + read_buffer.length(), trailer );
+
+    if( part ){
+
+        if( part != trailer.part )
+            status |= DecoderStatus::PART_MISMATCH;
+
+        if( status && decoding == DecodingOption::STRICT )
+            return status;
+
+        if( part_size != trailer.size || part_size != length )
+            status |= DecoderStatus::SIZE_MISMATCH;
+
+        if( status && decoding == DecodingOption::STRICT )
+            return status;
+
+        pcrc = trailer.pcrc;
+
+        if( pcrc != pcrc_val.checksum() ){
+
+            YENC_DEBUG( debug, "pcrc : %x, pcrc_val : %x", pcrc, pcrc_val.checksum() );
+            YENC_WARNING( warning, "pcrc mismatch!" );
+            status |= DecoderStatus::PART_CRC_MISMATCH;
+
+            if( decoding == DecodingOption::STRICT )
+                return status;
+        }
+
+    }else{
+
+        if( size != trailer.size )
+            status |= DecoderStatus::SIZE_MISMATCH;
+
+        if( status && decoding == DecodingOption::STRICT )
+            return status;
+
+    }
+
+    crc = trailer.crc;
+    ycrc32::Crc32 file_crc = pcrc_val;
+
+    //The crc of a multipart file can only be checked once all of its data has been decoded
+    if( crc && ( !part || fileCrc( file_crc ) ) && crc != file_crc.checksum() ){
+
+        YENC_DEBUG( debug, "crc : %x, crc_val : %x", crc, file_crc.checksum() );
+        YENC_WARNING( warning, "crc mismatch!" );
+        status |= DecoderStatus::CRC_MISMATCH;
+    }
+
+    return status;
+}
+
+/**
+* Find the header of an article held in memory, and read its values into @p result.
+*
+* @param nntp Set to \b true if @p input is a raw NNTP response. The search then stops at the line terminating the
+* response, and if no header was found before it, the consumed count of @p result is set to just after that line.
+*
+* @return The start of the encoded data, or NULL if no header was found or @p decoding is STRICT and the header is
+* malformed.
+*/
+const char* YDecoder::scanHeader( const char *input, size_t length, const DecodingOption::Option &decoding,
+                                  DecodeResult &result, bool nntp )
+{
+    const char *end = input + length;
+    const char *text = input;
+    const char *eol = end;
+
+    result = DecodeResult();
+    result.status = DecoderStatus::FAILED;
+
+    //Skip everything up to the header
+    for( ; text < end; text = eol + 1 ){
+        eol = lineEnd( text, end );
+
+        if( startsWith( text, eol, "=ybegin " ) )
+            break;
+
+        if( nntp && isTerminator( text, eol ) ){
+            result.consumed = ( eol < end ? eol + 1 : end ) - input;
+            return NULL;
+        }
+    }
+
+    if( text >= end )
+        return NULL;
+
+    parseBeginLine( text, eol, result );
+
+    if( !( result.line && result.size && result.name_length ) && decoding == DecodingOption::STRICT )
+        return NULL;
+
+    text = eol + 1;
+
+    if( result.part && text < end ){
+        eol = lineEnd( text, end );
+
+        if( startsWith( text, eol, "=ypart " ) ){
+            parsePartLine( text, eol, result );
+            text = eol + 1;
+        }else if( decoding == DecodingOption::STRICT ){
+            return NULL;
+        }
+
+    }
+
+    return text < end ? text : end;
+}
+
+/**
+* Locate the parts of an article held in memory and read its header and trailer. The header values are stored
+* in @p result, along with the values of the trailer if one was found.
+*
+* @param input The buffer holding the article.
+*
+* @param length The size of @p input.
+*
+* @param decoding With STRICT, a malformed header or a missing trailer is treated as a failure. With FORCE, the
+* data is assumed to run up to the end of the buffer if no trailer is found.
+*
+* @param result Receives the header and trailer values and the status of the scan.
+*
+* @param body_end Receives the end of the encoded data.
+*
+* @param file The mapping @p input lies in, if it is mapped. The pages that have been scanned are dropped from memory
+* as the scan goes along, so scanning a large article doesn't pull all of it into memory.
+*
+* @return The start of the encoded data, or NULL if the article could not be decoded.
+*/
+const char* YDecoder::scanArticle( const char *input, size_t length, const DecodingOption::Option &decoding,
+                                   DecodeResult &result, const char **body_end, yfile::MappedFile *file )
+{
+    const char *end = input + length;
+    const char *body = scanHeader( input, length, decoding, result, false );
+    const char *text = body;
+    const char *eol = end;
+
+    if( !body )
+        return NULL;
+
+    const char *released = body;
+
+    //The data runs up to the first line starting with =yend
+    for( ; text < end; text = eol + 1 ){
+        eol = lineEnd( text, end );
+
+        if( startsWith( text, eol, "=yend" ) )
+            break;
+
+        result.lines++;
+
+        if( file && static_cast<size_t>( eol - released ) >= block_size ){
+            file->release( released, eol );
+            released = eol;
+        }
+    }
+
+    result.status = DecoderStatus::SUCCESS;
+
+    if( text >= end ){
+
+        if( decoding == DecodingOption::STRICT ){
+            result.status = DecoderStatus::FAILED;
+            return NULL;
+        }
+
+        *body_end = end;
+        result.consumed = length;
+        return body;
+    }
+
+    *body_end = text;
+    result.consumed = eol < end ? eol + 1 - input : length;
+    parseEndLine( text, eol, result );
+    return body;
+}
+
+/**
+* Decode the articles in a file by mapping it into memory, and decoding the data straight from the mapping. This
+* does the same as the stream based decoding in decode(), without copying every line.
+*
+* @return The status of the decoder.
+*/
+DecoderStatus::Status YDecoder::decodeMapped( const string &input, const DecodingOption::Option &decoding )
+{
+    yfile::MappedFile file;
+
+    if( !file.map( input ) ){
+        YENC_ERROR( error, "Failed to open file %s", input.c_str() );
+        return DecoderStatus::FAILED;
+    }
+
+    const char *text = file.data();
+    const char *end = text + file.size();
+    DecoderStatus::Status status = DecoderStatus::SUCCESS;
+    DecodeResult result;
+    const char *body_end;
+    ystats::Stopwatch watch;
+
+    while( text < end ){
+        ystats::Stats sample;
+        const char *body = scanArticle( text, end - text, decoding, result, &body_end, memory_limit ? &file : NULL );
+
+        if( !body ){
+
+            //Without a header line there is nothing left to decode
+            if( result.line || result.size || result.name_length ){
+                YENC_ERROR( error, "Failed to parse header!" );
+                status = DecoderStatus::FAILED;
+            }
+
+            break;
+        }
+
+        text += result.consumed;
+
+        if( name.empty() ){
+            name = headers.copy( result.name, result.name_length );
+            YENC_DEBUG( debug, "Found name : %s", string( name.data(), name.size() ).c_str() );
+            size = result.size;
+            line = result.line;
+        }else if( name != boost::string_view( result.name, result.name_length ) ){
+            YENC_WARNING( warning, "Name mismatch!" );
+            status = DecoderStatus::NAME_MISMATCH;
+
+            if( decoding == DecodingOption::STRICT )
+                break;
+
+            continue;
+        }
+
+        if( result.part && ( !result.begin || result.end < result.begin || result.end > size ) ){
+            YENC_ERROR( error, "Invalid part range in part %llu!", static_cast<unsigned long long>( result.part ) );
+            status = DecoderStatus::FAILED;
+
+            if( decoding == DecodingOption::STRICT )
+                break;
+
+            continue;
+        }
+
+        part = result.part;
+        part_begin = result.begin;
+        total_parts = result.total;
+        part_size = part ? result.end - result.begin + 1 : size;
+
+        if( !output_directory.empty() && output_fd < 0 && !openOutput() ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        size_t capacity = part_size > 0 ? part_size : body_end - body;
+        size_t offset = data.size();
+        uint64_t part_offset = part && part_begin ? part_begin - 1 : 0;
+        char *output = NULL;
+        bool written = true;
+
+        if( output_fd < 0 && !growData( offset + capacity ) ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        bool blocks = output_fd >= 0 && !fitsInMemory( capacity );
+        bool resumed = resumePart( result );
+        char *buffer = resumed || output_fd < 0 ? NULL : output_buffer.reserve( blocks ? block_size : capacity );
+
+        if( !resumed && output_fd >= 0 && !buffer ){
+            YENC_ERROR( error, "Failed to allocate %llu bytes for part %llu", static_cast<unsigned long long>( capacity ),
+                        static_cast<unsigned long long>( part ) );
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        sample.header_ns = watch.lap();
+
+        if( resumed ){
+            YENC_DEBUG( debug, "Part %llu is already written, skipping", static_cast<unsigned long long>( part ) );
+        }else if( blocks ){
+            written = decodeBlocks( body, body_end, output_fd, part_offset, capacity, buffer, result, sample.write_ns, &file );
+        }else{
+
+            if( output_fd < 0 ){
+                output = &data[offset];
+            }else{
+                output = buffer;
+            }
+
+            decodeBody( body, body_end, output, capacity, result );
+        }
+
+        verifyResult( result );
+        sample.decode_ns = watch.lap() - sample.write_ns;
+        countData( result, body, body_end, sample );
+        file.release( text );
+        addPartCrc( output_fd < 0 ? offset : part_offset, result.checksum, result.length );
+        status = result.status;
+
+        if( result.status & DecoderStatus::PART_CRC_MISMATCH ){
+            YENC_DEBUG( debug, "pcrc : %x, pcrc_val : %x", result.pcrc, result.checksum );
+            YENC_WARNING( warning, "pcrc mismatch!" );
+        }
+
+        if( result.status & DecoderStatus::SIZE_MISMATCH )
+            YENC_WARNING( warning, "Size mismatch!" );
+
+        bool stored = output_fd >= 0 && !resumed && ( blocks || !( status & DecoderStatus::PART_CRC_MISMATCH ) ||
+                                                      decoding == DecodingOption::FORCE );
+
+        if( output_fd < 0 )
+            data.resize( offset + result.length );
+        else if( stored && !blocks )
+            written = yfile::writeAt( output_fd, output, result.length, part_offset );
+
+        sample.write_ns += watch.lap();
+
+        if( !written ){
+            YENC_ERROR( error, "Failed to write part %llu : %s", static_cast<unsigned long long>( part ), strerror( errno ) );
+            status |= DecoderStatus::FAILED;
+        }else if( stored ){
+            recordPart( result );
+        }
+
+        crc = result.crc;
+        ycrc32::Crc32 file_crc;
+        file_crc.combine( result.checksum, result.length );
+
+        if( crc && ( !part || fileCrc( file_crc ) || journalCrc( file_crc ) ) && crc != file_crc.checksum() ){
+            YENC_DEBUG( debug, "crc : %x, crc_val : %x", crc, file_crc.checksum() );
+            YENC_WARNING( warning, "crc mismatch!" );
+            status |= DecoderStatus::CRC_MISMATCH;
+        }
+
+        if( !resumed ){
+            countArticle( status, part, sample );
+            counters.add( sample );
+        }
+    }
+
+    commitJournal();
+    return status;
+}
+
+/**
+* Decode the articles in a file on a pipeline of threads. This thread reads the file one block at a time and finds the
+* headers and trailers in it, while the decoder threads decode the blocks it hands over and the writer thread stores the
+* decoded data, so the file is read, decoded and written all at the same time. The pipeline drains at the end of each
+* article, as the trailer can only be checked once all the data of the article has been decoded.
+*
+* @return The status of the decoder.
+*/
+DecoderStatus::Status YDecoder::decodePipelined( const string &input, const DecodingOption::Option &decoding )
+{
+    int fd = open( input.c_str(), O_RDONLY );
+
+    if( fd < 0 ){
+        YENC_ERROR( error, "Failed to open file %s", input.c_str() );
+        return DecoderStatus::FAILED;
+    }
+
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+    //The threads and blocks of the pipeline are kept from file to file
+    if( !pipeline )
+        pipeline = new ypipeline::Pipeline( threads, block_size );
+
+    BlockReader reader( fd, *pipeline );
+    DecoderStatus::Status status = DecoderStatus::SUCCESS;
+    DecodeResult result;
+    ystats::Stopwatch watch;
+
+    for( const char *eol; ( eol = reader.line() ) < reader.end(); ){
+
+        if( !startsWith( reader.begin(), eol, "=ybegin " ) ){
+            reader.skip( eol + 1 );
+            continue;
+        }
+
+        //Make sure the =ypart line is in the block as well before parsing the header
+        size_t header_length = eol + 1 - reader.begin();
+        const char *header_end = reader.line( header_length );
+        const char *body = scanHeader( reader.begin(), min( header_end + 1, reader.end() ) - reader.begin(), decoding, result, false );
+
+        if( !body ){
+            YENC_ERROR( error, "Failed to parse header!" );
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        reader.skip( body );
+        result.status = DecoderStatus::SUCCESS;
+        ystats::Stats sample;
+        sample.header_ns = watch.lap();
+
+        if( name.empty() ){
+            name = headers.copy( result.name, result.name_length );
+            YENC_DEBUG( debug, "Found name : %s", string( name.data(), name.size() ).c_str() );
+            size = result.size;
+            line = result.line;
+        }else if( name != boost::string_view( result.name, result.name_length ) ){
+            YENC_WARNING( warning, "Name mismatch!" );
+            status = DecoderStatus::NAME_MISMATCH;
+
+            if( decoding == DecodingOption::STRICT )
+                break;
+
+            continue;
+        }
+
+        if( result.part && ( !result.begin || result.end < result.begin || result.end > size ) ){
+            YENC_ERROR( error, "Invalid part range in part %llu!", static_cast<unsigned long long>( result.part ) );
+            status = DecoderStatus::FAILED;
+
+            if( decoding == DecodingOption::STRICT )
+                break;
+
+            continue;
+        }
+
+        //The name points into the block, which is about to be handed over
+        result.name = NULL;
+        result.name_length = 0;
+        part = result.part;
+        part_begin = result.begin;
+        total_parts = result.total;
+        part_size = part ? result.end - result.begin + 1 : size;
+
+        if( !output_directory.empty() && output_fd < 0 && !openOutput() ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        size_t offset = data.size();
+
+        if( output_fd < 0 && !growData( offset + part_size ) ){
+            status = DecoderStatus::FAILED;
+            break;
+        }
+
+        ypipeline::Article article;
+        article.fd = output_fd;
+        article.capacity = part_size;
+
+        if( output_fd < 0 ){
+            article.offset = offset;
+            article.memory = &data[0];
+        }else{
+            article.offset = part && part_begin ? part_begin - 1 : 0;
+        }
+
+        //Hand the data over a block at a time, up to the trailer, and count only the time the threads of the pipeline spend
+        //on it as decoding and writing
+        bool line_start = true;
+        bool trailer = false;
+
+        for( ;; ){
+
+            if( reader.end() - reader.begin() < static_cast<ptrdiff_t>( block_size / 2 ) )
+                reader.more();
+
+            const char *text = reader.begin();
+            const char *end = reader.end();
+            const char *found = line_start && startsWith( text, end, "=yend" ) ? text
+                                : static_cast<const char*>( memmem( text, end - text, "\n=yend", 6 ) );
+
+            if( found ){
+                found += *found == '\n';
+                trailer = true;
+                reader.submit( found, article, true );
+                break;
+            }
+
+            if( reader.finished() ){
+                reader.submit( end, article, true );
+                break;
+            }
+
+            const char *cut = blockCut( text, end );
+
+            //Only a block holding nothing but escape characters and line endings has no clean cut
+            if( cut == text )
+                cut = end;
+
+            line_start = cut[-1] == '\n';
+            reader.submit( cut, article, false );
+        }
+
+        pipeline->finish( article );
+        watch.lap();
+        result.length = article.length;
+        result.checksum = article.checksum.checksum();
+
+        if( article.overflow )
+            result.status |= DecoderStatus::SIZE_MISMATCH;
+
+        if( output_fd < 0 )
+            data.resize( article.offset + article.length );
+
+        if( trailer ){
+            eol = reader.line();
+            parseEndLine( reader.begin(), eol, result );
+            reader.skip( eol + 1 );
+        }else if( decoding == DecodingOption::STRICT ){
+            YENC_ERROR( error, "Failed to find trailer!" );
+            status = DecoderStatus::FAILED;
+
+            if( output_fd < 0 )
+                data.resize( article.offset );
+
+            break;
+        }
+
+        verifyResult( result );
+        addPartCrc( article.offset, result.checksum, result.length );
+        status = result.status;
+
+        if( result.status & DecoderStatus::PART_CRC_MISMATCH ){
+            YENC_DEBUG( debug, "pcrc : %x, pcrc_val : %x", result.pcrc, result.checksum );
+            YENC_WARNING( warning, "pcrc mismatch!" );
+        }
+
+        if( result.status & DecoderStatus::SIZE_MISMATCH )
+            YENC_WARNING( warning, "Size mismatch!" );
+
+        if( article.error ){
+            YENC_ERROR( error, "Failed to write part %llu : %s", static_cast<unsigned long long>( part ), strerror( article.error ) );
+            status |= DecoderStatus::FAILED;
+        }
+
+        crc = result.crc;
+        ycrc32::Crc32 file_crc;
+        file_crc.combine( result.checksum, result.length );
+
+        if( crc && ( !part || fileCrc( file_crc ) ) && crc != file_crc.checksum() ){
+            YENC_DEBUG( debug, "crc : %x, crc_val : %x", crc, file_crc.checksum() );
+            YENC_WARNING( warning, "crc mismatch!" );
+            status |= DecoderStatus::CRC_MISMATCH;
+        }
+
+        sample.header_ns += watch.lap();
+        sample.decode_ns = article.decode_time;
+        sample.write_ns = article.write_time;
+        sample.bytes_in = article.encoded;
+        sample.bytes_out = article.length;
+        countArticle( status, part, sample );
+        counters.add( sample );
+    }
+
+    if( reader.failure() ){
+        YENC_ERROR( error, "Failed to read file %s : %s", input.c_str(), strerror( reader.failure() ) );
+        status |= DecoderStatus::FAILED;
+    }
+
+    close( fd );
+    return status;
+}
+
+/**
+* Decode the data of an article into a buffer, and calculate its checksum. If the buffer fills up before
+* all the data has been decoded, the SIZE_MISMATCH flag is set in the status of @p result.
+*/
+void YDecoder::decodeBody( const char *body, const char *body_end, char *output, size_t capacity, DecodeResult &result )
+{
+    const unsigned char *src = reinterpret_cast<const unsigned char*>( body );
+    const unsigned char *end = reinterpret_cast<const unsigned char*>( body_end );
+    unsigned char *dst = reinterpret_cast<unsigned char*>( output );
+    const ykernel::SpanDecoder decode_span = ykernel::decoder( lineEnding( body, body_end ), true );
+    size_t length = 0;
+    uint32_t checksum = 0;
+    bool escape = false;
+
+    //A chunk never decodes to more bytes than it holds, so limiting chunks to the space left can't overflow
+    while( src < end && length < capacity ){
+        size_t chunk = min( static_cast<size_t>( end - src ), capacity - length );
+        length += decode_span( src, chunk, dst + length, escape, checksum );
+        src += chunk;
+    }
+
+    if( hasData( src, end, escape ) )
+        result.status |= DecoderStatus::SIZE_MISMATCH;
+
+    result.checksum = checksum;
+    result.data = output;
+    result.length = length;
+}
+
+/**
+* Decode the data of an article straight from a raw NNTP response into a buffer, and calculate its checksum, like
+* decodeBody(). The dot stuffing is undone and the end of the data is found by the decode kernel, so the data is only
+* read once, after which the trailer is read and the line terminating the response is skipped.
+*
+* @param body The start of the encoded data, as returned by scanHeader().
+*
+* @return \b false if no trailer was found and @p decoding is STRICT, otherwise \b true.
+*/
+bool YDecoder::decodeNntp( const char *input, size_t length, const char *body, char *output, size_t capacity,
+                           const DecodingOption::Option &decoding, DecodeResult &result )
+{
+    const char *end = input + length;
+    const unsigned char *src = reinterpret_cast<const unsigned char*>( body );
+    const unsigned char *src_end = reinterpret_cast<const unsigned char*>( end );
+    unsigned char *dst = reinterpret_cast<unsigned char*>( output );
+    size_t decoded = 0;
+    uint32_t checksum = 0;
+    ykernel::NntpState state;
+
+    result.status = DecoderStatus::SUCCESS;
+
+    while( src < src_end && !state.end && decoded < capacity ){
+        size_t chunk = min( static_cast<size_t>( src_end - src ), capacity - decoded );
+        size_t used;
+        decoded += ykernel::decodeNntpCrc( src, chunk, dst + decoded, state, used, checksum );
+        src += used;
+    }
+
+    //The buffer is full, so find the end of the data, and check whether there was more of it
+    while( src < src_end && !state.end ){
+        unsigned char scratch[64];
+        size_t used;
+
+        if( ykernel::decodeNntp( src, min( static_cast<size_t>( src_end - src ), sizeof( scratch ) ), scratch, state, used ) )
+            result.status |= DecoderStatus::SIZE_MISMATCH;
+
+        src += used;
+    }
+
+    result.checksum = checksum;
+    result.data = output;
+    result.length = decoded;
+
+    //The kernel stops just after the first 2 bytes of the line ending the data
+    const char *text = reinterpret_cast<const char*>( src ) - 2;
+
+    if( state.end == ykernel::NntpState::TRAILER ){
+        const char *eol = lineEnd( text, end );
+        parseEndLine( text, eol, result );
+        text = eol < end ? eol + 1 : end;
+    }
+
+    result.consumed = ( state.end ? skipTerminator( text, end ) : end ) - input;
+
+    if( state.end != ykernel::NntpState::TRAILER && decoding == DecodingOption::STRICT ){
+        result.status = DecoderStatus::FAILED;
+
+        if( !state.end )
+            result.consumed = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Decode the data of an article one block at a time through @p buffer, and write each block to @p fd as soon as it
+* is decoded, starting at @p offset. This takes the same amount of memory however large the article is. Since the
+* data is written before its checksum is known, it is written even if it turns out not to match the pcrc32.
+*
+* @param buffer A buffer of at least block_size bytes.
+*
+* @param capacity The most data to decode. If there is more, the SIZE_MISMATCH flag is set in the status of @p result.
+*
+* @param write_time Receives the time spent writing the blocks added to it, in nanoseconds.
+*
+* @param file The mapping @p body lies in, if it is mapped. Each block of input is dropped from memory once it is decoded.
+*
+* @return \b true if all the data was written, otherwise \b false.
+*/
+bool YDecoder::decodeBlocks( const char *body, const char *body_end, int fd, uint64_t offset, uint64_t capacity,
+                             char *buffer, DecodeResult &result, uint64_t &write_time, yfile::MappedFile *file )
+{
+    const unsigned char *src = reinterpret_cast<const unsigned char*>( body );
+    const unsigned char *end = reinterpret_cast<const unsigned char*>( body_end );
+    const ykernel::SpanDecoder decode_span = ykernel::decoder( lineEnding( body, body_end ), true );
+    uint64_t length = 0;
+    ycrc32::Crc32 checksum;
+    bool escape = false;
+    bool written = true;
+    unsigned char *dst = reinterpret_cast<unsigned char*>( buffer );
+
+    while( src < end && length < capacity ){
+        size_t chunk = min<uint64_t>( min( static_cast<size_t>( end - src ), block_size ), capacity - length );
+        uint32_t crc = 0;
+        size_t produced = decode_span( src, chunk, dst, escape, crc );
+        checksum.combine( crc, produced );
+        ystats::Stopwatch watch;
+        written = written && yfile::writeAt( fd, buffer, produced, offset + length );
+        write_time += watch.lap();
+        length += produced;
+
+        if( file )
+            file->release( reinterpret_cast<const char*>( src ), reinterpret_cast<const char*>( src + chunk ) );
+
+        src += chunk;
+    }
+
+    if( hasData( src, end, escape ) )
+        result.status |= DecoderStatus::SIZE_MISMATCH;
+
+    result.checksum = checksum.checksum();
+    result.data = NULL;
+    result.length = length;
+    return written;
+}
+
+bool YDecoder::write( const char *path )
+{
+    if( name.empty() ){
+        YENC_ERROR( error, "Unable to write to file : filename not set" );
+        return false;
+    }
+
+    //The data has been written while decoding, only the file is left to close, along with its journal once it is complete
+    if( output_fd >= 0 && !spilled ){
+        ycrc32::Crc32 file_crc;
+
+        if( journal && journal->isOpen() && journal->contiguous( file_crc ) == size )
+            journal->remove();
+
+        closeOutput();
+        return true;
+    }
+
+    filesystem::path p( path );
+
+    if( !checkDirectory( p ) )
+        return false;
+
+    ystats::Stopwatch watch;
+    ystats::Stats sample;
+
+    //The data outgrew the memory limit, so copy it over from the temporary file
+    if( spilled ){
+        p /= string( name.data(), name.size() );
+        int fd = yfile::createFile( p.native_file_string(), size );
+
+        if( fd < 0 ){
+            YENC_ERROR( error, "Failed to open %s for writing, aborting!", p.native_file_string().c_str() );
+            closeOutput();
+            return false;
+        }
+
+        YENC_DEBUG( debug, "Writing data to %s", p.native_file_string().c_str() );
+        bool copied = yfile::copyFile( output_fd, fd, size, block_size );
+
+        if( close( fd ) != 0 || !copied ){
+            YENC_ERROR( error, "Error in writing to file  %s : %s", p.native_file_string().c_str(), strerror( errno ) );
+            copied = false;
+        }
+
+        closeOutput();
+        sample.write_ns = watch.lap();
+        counters.add( sample );
+        return copied;
+    }
+
+    //Append the current filename to the path
+    p /= string( name.data(), name.size() );
+    int fd = yfile::createFile( p.native_file_string(), data.length() );
+
+    if( fd < 0 ){
+        YENC_ERROR( error, "Failed to open %s for writing, aborting!", p.native_file_string().c_str() );
+        return false;
+    }
+
+    if( !io )
+        io = new yio::IoEngine;
+
+    YENC_DEBUG( debug, "Writing data to %s", p.native_file_string().c_str() );
+    io->write( fd, data.data(), data.length(), 0 );
+    bool written = io->flush();
+    written = close( fd ) == 0 && written;
+    sample.write_ns = watch.lap();
+    counters.add( sample );
+
+    if( !written ){
+        YENC_ERROR( error, "Error in writing to file  %s : %s", p.native_file_string().c_str(), strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
+
+ystats::Stats YDecoder::stats() const
+{
+    return counters.snapshot();
+}
+
+void YDecoder::resetStats()
+{
+    counters.reset();
+}
+
+/**
+* Make sure the decoded files can be written to a directory, creating the directory if it doesn't exist.
+*
+* @return \b true if @p p is a directory, otherwise \b false.
+*/
+bool YDecoder::checkDirectory( const filesystem::path &p )
+{
+    try{
+
+        if( !exists( p ) ){
+            YENC_WARNING( warning, "Directory %s doesn't exist, creating...", p.native_file_string().c_str() );
+
+            if( !create_directory( p ) ){
+                YENC_ERROR( error, "Failed to create directory %s, aborting!", p.native_file_string().c_str() );
+                return false;
+            }
+
+        }else{
+
+            if( !is_directory( p ) ){
+                YENC_ERROR( error, "%s is not a directory, aborting!", p.native_file_string().c_str() );
+                return false;
+            }
+
+        }
+
+        return true;
+
+    }catch( filesystem_error &err ){
+        string sys_err;
+        system_message( err.system_error(), sys_err );
+        YENC_ERROR( error, "Error in accessing directory  %s : %s", p.native_file_string().c_str(), sys_err.c_str() );
+        return false;
+    }
+}
+
+/**
+* Create the file the decoded data is written to in the output directory, and reserve the size given in the header
+* for it, so the parts can be written at their offsets without fragmenting the file. Call this function once the
+* header has been read.
+*
+* @return \b true if the file was created, otherwise \b false.
+*/
+bool YDecoder::openOutput()
+{
+    if( name.empty() ){
+        YENC_ERROR( error, "Unable to open the output file : filename not set" );
+        return false;
+    }
+
+    filesystem::path p( output_directory );
+    p /= string( name.data(), name.size() );
+
+    if( journaling ){
+
+        if( !journal )
+            journal = new yjournal::PartJournal;
+
+        if( !journal->open( p.native_file_string() + ".yjournal", size ) )
+            YENC_WARNING( warning, "Failed to open the journal of %s, carrying on without it : %s", p.native_file_string().c_str(),
+                          strerror( errno ) );
+
+        //The parts recorded by an earlier run are already in the file, so it mustn't be truncated
+        if( journal->count() ){
+
+            if( ( output_fd = yfile::openFile( p.native_file_string(), size ) ) >= 0 ){
+                YENC_MESSAGE( message, "Resuming %s, %llu of %llu bytes are already written", p.native_file_string().c_str(),
+                              static_cast<unsigned long long>( journal->recorded() ), static_cast<unsigned long long>( size ) );
+                return true;
+            }
+
+            //The file the journal was kept for is gone, so its records are worthless
+            if( !journal->clear() )
+                journal->close();
+
+        }
+    }
+
+    output_fd = yfile::createFile( p.native_file_string(), size );
+
+    if( output_fd < 0 ){
+        YENC_ERROR( error, "Failed to create %s : %s", p.native_file_string().c_str(), strerror( errno ) );
+        return false;
+    }
+
+    YENC_DEBUG( debug, "Writing data to %s", p.native_file_string().c_str() );
+    return true;
+}
+
+void YDecoder::closeOutput()
+{
+    if( output_fd >= 0 ){
+        close( output_fd );
+        output_fd = -1;
+    }
+
+    if( journal )
+        journal->close();
+
+    spilled = false;
+}
+
+/**
+* Check the journal for a part written by an earlier run. A part is only skipped if its range was recorded with the crc32
+* its trailer gives, so a part that failed its check, or a different article for the same range, is decoded again. If
+* the trailer has no crc32, the record is trusted as it is.
+*
+* @return \b true if the part is already in the file, in which case the length and crc32 of @p result are filled in as if
+* it had just been decoded, otherwise \b false.
+*/
+bool YDecoder::resumePart( DecodeResult &result ) const
+{
+    uint64_t begin, end;
+    uint32_t recorded;
+    uint32_t expected = result.part ? result.pcrc : result.crc;
+    partRange( result, begin, end );
+
+    if( !journal || !journal->isOpen() || !journal->find( begin, end, recorded ) || ( expected && expected != recorded ) )
+        return false;
+
+    result.checksum = recorded;
+    result.length = end - begin + 1;
+    result.data = NULL;
+    return true;
+}
+
+/**
+* Add a part that has been written to the output file to the journal, if one is kept. Parts whose data doesn't fill
+* their range are left out, as their crc32 can't be combined with the others.
+*/
+void YDecoder::recordPart( const DecodeResult &result )
+{
+    uint64_t begin, end;
+    partRange( result, begin, end );
+
+    if( journal && journal->isOpen() && begin && end >= begin && end <= size && result.length == end - begin + 1 )
+        journal->add( begin, end, result.checksum );
+
+}
+
+/**
+* Write the parts recorded since the last call to the journal.
+*/
+void YDecoder::commitJournal()
+{
+    if( journal && journal->isOpen() && !journal->commit( output_fd ) )
+        YENC_WARNING( warning, "Failed to update the journal of %s : %s", string( name.data(), name.size() ).c_str(),
+                      strerror( errno ) );
+
+}
+
+/**
+* Work out the crc32 of the whole file from the part crcs in the journal. This is only done once the parts recorded
+* add up to the size of the file, as it takes a pass over all the records.
+*
+* @return \b true if the journal covers the whole file, in which case @p file_crc is set to its crc32, otherwise \b false.
+*/
+bool YDecoder::journalCrc( ycrc32::Crc32 &file_crc ) const
+{
+    if( !journal || !journal->isOpen() || journal->recorded() < size )
+        return false;
+
+    ycrc32::Crc32 combined;
+
+    if( journal->contiguous( combined ) != size )
+        return false;
+
+    file_crc = combined;
+    return true;
+}
+
+/**
+* Keep the crc32 of a part along with where its data went, at @p offset in the file, or in the data in memory.
+*/
+void YDecoder::addPartCrc( uint64_t offset, uint32_t checksum, uint64_t length )
+{
+    PartCrc part_crc;
+    part_crc.offset = offset;
+    part_crc.length = length;
+    part_crc.crc = checksum;
+    part_crcs.push_back( part_crc );
+    part_crc_bytes += length;
+}
+
+/**
+* Work out the crc32 of the whole file from the part crcs, combined in the order of where the data of the parts went,
+* so the parts can be decoded in any order. This is only done once the parts add up to the size of the file, as it
+* takes a sort of all the parts.
+*
+* @return \b true if the parts cover the whole file, in which case @p file_crc is set to its crc32, otherwise \b false.
+*/
+bool YDecoder::fileCrc( ycrc32::Crc32 &file_crc )
+{
+    if( part_crc_bytes < size )
+        return false;
+
+    sort( part_crcs.begin(), part_crcs.end(), []( const PartCrc &a, const PartCrc &b ){ return a.offset < b.offset; } );
+    ycrc32::Crc32 combined;
+
+    //A part that was decoded twice starts before the end of what has been combined already, and is left out
+    for( size_t i = 0; i < part_crcs.size() && part_crcs[i].offset <= combined.size(); i++ ){
+
+        if( part_crcs[i].offset == combined.size() )
+            combined.combine( part_crcs[i].crc, part_crcs[i].length );
+
+    }
+
+    if( combined.size() != size )
+        return false;
+
+    file_crc = combined;
+    return true;
+}
+
+/**
+* Send a warning for each problem found when checking a decoded article.
+*/
+void YDecoder::reportResult( const DecodeResult &result )
+{
+    if( result.status & DecoderStatus::SIZE_MISMATCH )
+        YENC_WARNING( warning, "Size mismatch!" );
+
+    if( result.status & DecoderStatus::PART_CRC_MISMATCH )
+        YENC_WARNING( warning, "pcrc mismatch!" );
+
+    if( result.status & DecoderStatus::CRC_MISMATCH )
+        YENC_WARNING( warning, "crc mismatch!" );
+
+}
+
+/**
+* @return \b true if @p length bytes of decoded data are within the memory limit.
+*/
+bool YDecoder::fitsInMemory( uint64_t length ) const
+{
+    return !memory_limit || length <= memory_limit;
+}
+
+/**
+* Move the data decoded so far to a temporary file, and write the rest of the file there as well, so it no longer has
+* to fit in memory. Call this function once the header has been read.
+*
+* @return \b true if the temporary file was created, otherwise \b false.
+*/
+bool YDecoder::startSpill()
+{
+    string directory = spill_directory;
+
+    if( directory.empty() ){
+        const char *tmp = getenv( "TMPDIR" );
+        directory = tmp && *tmp ? tmp : "/var/tmp";
+    }
+
+    output_fd = yfile::createTemporary( directory, size );
+
+    if( output_fd < 0 ){
+        YENC_ERROR( error, "Failed to create a temporary file in %s : %s", directory.c_str(), strerror( errno ) );
+        return false;
+    }
+
+    YENC_DEBUG( debug, "%s exceeds the memory limit, moving its data to %s", string( name.data(), name.size() ).c_str(),
+                directory.c_str() );
+
+    if( !yfile::writeAt( output_fd, data.data(), data.size(), 0 ) ){
+        YENC_ERROR( error, "Failed to write to a temporary file in %s : %s", directory.c_str(), strerror( errno ) );
+        closeOutput();
+        return false;
+    }
+
+    string().swap( data );
+    spilled = true;
+    return true;
+}
+
+/**
+* Make room for @p length bytes of decoded data in memory. The length comes from a header, so it may be anything: if it
+* is beyond the memory limit, or the memory can't be had, the data is moved to a temporary file instead.
+*
+* @return \b true if the data has room in memory or was moved to a temporary file, otherwise \b false.
+*/
+bool YDecoder::growData( uint64_t length )
+{
+    if( length <= data.size() )
+        return true;
+
+    if( fitsInMemory( length ) ){
+
+        try{
+            data.resize( length );
+            return true;
+        }catch( const std::exception& ){
+            YENC_WARNING( warning, "Failed to allocate %llu bytes for %s", static_cast<unsigned long long>( length ),
+                          string( name.data(), name.size() ).c_str() );
+        }
+
+    }
+
+    return startSpill();
+}
+
+YStreamDecoder::YStreamDecoder( const DecodingOption::Option &decoding )
+    : decoding( decoding )
+{
+    reset();
+}
+
+YStreamDecoder::~YStreamDecoder()
+{
+}
+
+void YStreamDecoder::reset()
+{
+    state = HEADER;
+    result = DecodeResult();
+    line_length = 0;
+    line_start = true;
+    escape = false;
+    pending_escape = false;
+    output_length = 0;
+    checksum.reset();
+}
+
+bool YStreamDecoder::done() const
+{
+    return state == DONE;
+}
+
+bool YStreamDecoder::feed( const char *input, size_t length )
+{
+    const char *end = input + length;
+    bool complete, matched;
+
+    while( input < end ){
+
+        switch( state ){
+            case HEADER:
+                input = readLine( input, end, &complete );
+
+                if( !complete )
+                    break;
+
+                if( startsWith( line_buffer, line_buffer + line_length, "=ybegin " ) ){
+                    //The name in the result points into the header line, so keep it out of the way of the other lines
+                    memcpy( header_line, line_buffer, line_length );
+                    parseBeginLine( header_line, header_line + line_length, result );
+
+                    if( !( result.line && result.size && result.name_length ) && decoding == DecodingOption::STRICT ){
+                        YENC_ERROR( error, "Unable to find all required header variables!" );
+                        state = FAILED;
+                        break;
+                    }
+
+                    if( result.part )
+                        state = PART;
+                    else
+                        startBody();
+
+                }
+
+                line_length = 0;
+                break;
+
+            case PART:
+                input = readTag( input, end, "=ypart ", &matched );
+
+                if( !matched ){
+
+                    if( decoding == DecodingOption::STRICT ){
+                        YENC_ERROR( error, "Missing part header!" );
+                        state = FAILED;
+                        break;
+                    }
+
+                    //Without a part header, the line is just data, and the rest of it is decoded straight from the input
+                    startBody();
+                    decodeChunk( line_buffer, line_length );
+                    line_length = 0;
+                    line_start = false;
+                    break;
+                }
+
+                input = readLine( input, end, &complete );
+
+                if( !complete )
+                    break;
+
+                parsePartLine( line_buffer, line_buffer + line_length, result );
+                startBody();
+                line_length = 0;
+                break;
+
+            case BODY:
+                input = decodeData( input, end );
+                break;
+
+            case TRAILER:
+                input = readTag( input, end, "=yend", &matched );
+
+                if( !matched ){
+                    //Some other line starting with =y, which has to be data
+                    state = BODY;
+                    decodeChunk( line_buffer, line_length );
+                    line_length = 0;
+                    line_start = false;
+                    break;
+                }
+
+                input = readLine( input, end, &complete );
+
+                if( !complete )
+                    break;
+
+                parseEndLine( line_buffer, line_buffer + line_length, result );
+                state = DONE;
+                line_length = 0;
+                break;
+
+            case DONE:
+            case FAILED:
+                input = end;
+                break;
+        }
+
+    }
+
+    return state != FAILED;
+}
+
+DecodeResult YStreamDecoder::finish()
+{
+    if( state == PART || state == BODY || state == TRAILER ){
+
+        if( decoding == DecodingOption::STRICT ){
+            YENC_ERROR( error, "Missing trailer!" );
+            state = FAILED;
+        }else if( state == TRAILER && startsWith( line_buffer, line_buffer + line_length, "=yend" ) ){
+            parseEndLine( line_buffer, line_buffer + line_length, result );
+        }
+
+    }
+
+    if( state == HEADER || state == FAILED ){
+
+        if( state == HEADER )
+            YENC_ERROR( error, "Failed to parse header!" );
+
+        result.status = DecoderStatus::FAILED;
+        return result;
+    }
+
+    result.data = output.data();
+    result.length = output_length;
+    result.checksum = checksum.checksum();
+    verifyResult( result );
+
+    if( result.status & DecoderStatus::SIZE_MISMATCH )
+        YENC_WARNING( warning, "Size mismatch!" );
+
+    if( result.status & DecoderStatus::PART_CRC_MISMATCH )
+        YENC_WARNING( warning, "pcrc mismatch!" );
+
+    if( result.status & DecoderStatus::CRC_MISMATCH )
+        YENC_WARNING( warning, "crc mismatch!" );
+
+    return result;
+}
+
+/**
+* Append the input up to the end of the current line to the line buffer. Lines that don't fit into the buffer
+* are truncated, which is harmless since only header and trailer lines are ever read this way.
+*
+* @param complete Set to \b true if the end of the line was reached.
+*
+* @return The start of the next line, or @p end if the line continues in the next chunk.
+*/
+const char* YStreamDecoder::readLine( const char *input, const char *end, bool *complete )
+{
+    const char *eol = lineEnd( input, end );
+    size_t chunk = min( static_cast<size_t>( eol - input ), max_line - line_length );
+    memcpy( line_buffer + line_length, input, chunk );
+    line_length += chunk;
+    *complete = eol < end;
+    return *complete ? eol + 1 : end;
+}
+
+/**
+* Append the start of the current line to the line buffer, up to where it can be told apart from a line of data that
+* doesn't start with @p tag. A line of data is only read this far, so the rest of it can be decoded from the input and
+* isn't truncated by the line buffer.
+*
+* @param matched Set to \b false as soon as the line turns out not to start with @p tag.
+*
+* @return The position where reading stopped, which is the first byte that didn't match if @p matched is \b false.
+*/
+const char* YStreamDecoder::readTag( const char *input, const char *end, const char *tag, bool *matched )
+{
+    size_t tag_length = strlen( tag );
+
+    for( ; line_length < tag_length && input < end; input++ ){
+
+        if( *input != tag[line_length] ){
+            *matched = false;
+            return input;
+        }
+
+        line_buffer[line_length++] = *input;
+    }
+
+    *matched = true;
+    return input;
+}
+
+/**
+* Decode data up to the trailer, or up to the end of the chunk. Since the trailer can only be recognized at the start
+* of a line, a '=' at the start of a line that is the last byte of the chunk is held back until the next chunk shows
+* whether it is an escape character or the start of the trailer.
+*
+* @return The position where decoding stopped, which is the start of the trailer if it was found.
+*/
+const char* YStreamDecoder::decodeData( const char *input, const char *end )
+{
+    while( input < end ){
+
+        if( line_start ){
+
+            if( pending_escape ){
+                pending_escape = false;
+
+                if( *input == 'y' ){
+                    line_buffer[0] = '=';
+                    line_length = 1;
+                    state = TRAILER;
+                    return input;
+                }
+
+                decodeChunk( "=", 1 );
+            }else if( *input == '=' ){
+
+                if( input + 1 == end ){
+                    pending_escape = true;
+                    return end;
+                }
+
+                if( input[1] == 'y' ){
+                    line_length = 0;
+                    state = TRAILER;
+                    return input;
+                }
+
+            }
+
+            line_start = false;
+        }
+
+        //Decode everything up to the next line that starts with a '=', since that could be the trailer
+        const char *run_end = end;
+
+        for( const char *text = input; ( text = static_cast<const char*>( memchr( text, '\n', end - text ) ) ); ){
+            text++;
+
+            if( text == end || *text == '=' ){
+                run_end = text;
+                line_start = true;
+                break;
+            }
+
+        }
+
+        decodeChunk( input, run_end - input );
+        input = run_end;
+    }
+
+    return input;
+}
+
+/**
+* Decode a run of data onto the end of the output buffer, growing the buffer if needed, and add the decoded bytes
+* to the checksum while they are still in the cache.
+*/
+void YStreamDecoder::decodeChunk( const char *input, size_t chunk )
+{
+    if( output.size() < output_length + chunk )
+        output.resize( max( output_length + chunk, output.size() * 2 ) );
+
+    uint32_t crc = 0;
+    size_t produced = ykernel::decodeCrc( reinterpret_cast<const unsigned char*>( input ), chunk,
+                                          reinterpret_cast<unsigned char*>( &output[output_length] ), escape, crc );
+    checksum.combine( crc, produced );
+    output_length += produced;
+}
+
+/**
+* Switch to decoding data, and size the output buffer for the data announced by the header.
+*/
+void YStreamDecoder::startBody()
+{
+    uint64_t expected = result.part ? result.end - result.begin + 1 : result.size;
+
+    //Don't let a bogus header make us allocate a huge buffer up front; it will still grow as needed
+    if( expected > output.size() && expected <= ( 1 << 26 ) )
+        output.resize( expected );
+
+    state = BODY;
+    line_start = true;
+    escape = false;
 }
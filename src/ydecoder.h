@@ -25,13 +25,37 @@
 #ifndef YDECODER_YDECODER_H
 #define YDECODER_YDECODER_H
 
-#include <boost/crc.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <sigc++/sigc++.h>
+#include <stdint.h>
 #include <string>
 #include <sstream>
+#include <vector>
+#include "ybuffer.h"
+#include "ycrc32.h"
+#include "ystats.h"
 // #include "bitwise_enums.hpp"
 
+namespace ythreadpool{
+    class ThreadPool;
+}
+
+namespace yfile{
+    class MappedFile;
+}
+
+namespace yio{
+    class IoEngine;
+}
+
+namespace yjournal{
+    class PartJournal;
+}
+
+namespace ypipeline{
+    class Pipeline;
+}
+
 using namespace boost;
 using namespace boost::filesystem;
 using namespace sigc;
@@ -58,6 +82,11 @@ namespace ydecoder{
                 NAME_MISMATCH = 16, /**< The name value in the header doesn't match the name of the previous parts */
                 FAILED =  32/**< The decoding failed */
             };
+
+            /**
+             * Add the flags of @p flag to @p status.
+             */
+            inline Status& operator|=( Status &status, Status flag ){ return status = static_cast<Status>( status | flag ); }
     }
 
 //             DecoderStatus() : status( SUCCESS ){}
@@ -122,6 +151,98 @@ namespace ydecoder{
 
 //     typedef bitwise_enum<Option> DecodingOption;
 
+    namespace InputMode{
+            enum Mode{
+                STREAM = 0, /**< Read the input files through a file stream, one line at a time */
+                MAPPED, /**< Map the input files into memory and decode the mapped data directly, without copying it */
+                PIPELINED /**< Read the input files one block at a time on one thread, while other threads decode the blocks read so far and write out the decoded data */
+            };
+    }
+
+    namespace ArticleFormat{
+            enum Format{
+                PLAIN = 0, /**< The article is held as it was posted */
+                NNTP /**< The article is a raw NNTP response body: lines starting with a dot have another dot stuffed in front of them, and the response ends on a line holding a single dot */
+            };
+    }
+
+    /**
+     * @struct DecodeResult ydecoder.h
+     *
+     * @brief Holds the outcome of decoding a single article from memory.
+     *
+     * The header and trailer values are copied out of the article, with the exception of the name, which points
+     * into the input buffer and is only valid for as long as that buffer is. Values that were not present in the
+     * article are left at 0.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct DecodeResult{
+        DecoderStatus::Status status; /**< The status of the decoding operation */
+        const char *name; /**< The name value from the header. This is not null terminated */
+        size_t name_length; /**< The length of the name value */
+        uint64_t line; /**< The line value from the header */
+        uint64_t size; /**< The size value from the header, ie. the size of the complete file */
+        uint64_t part; /**< The part value from the header, 0 if this is not a multipart article */
+        uint64_t total; /**< The total value from the header */
+        uint64_t begin; /**< The begin value from the part header, counting from 1 */
+        uint64_t end; /**< The end value from the part header */
+        uint64_t trailer_size; /**< The size value from the trailer */
+        uint32_t crc; /**< The crc32 value from the trailer */
+        uint32_t pcrc; /**< The pcrc32 value from the trailer */
+        uint32_t checksum; /**< The crc32 of the decoded data */
+        const char *data; /**< The decoded data */
+        size_t length; /**< The number of bytes of decoded data */
+        size_t consumed; /**< The number of input bytes up to and including the trailer line */
+        uint64_t lines; /**< The number of lines of encoded data, or 0 if the end of the data was found without splitting it into lines */
+    };
+
+    /**
+     * @struct ArticleSpan ydecoder.h
+     *
+     * @brief An article in memory, as one of a batch passed to YDecoder::decodeBatch().
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct ArticleSpan{
+        const char *data; /**< The article */
+        size_t length; /**< The number of bytes in @p data */
+    };
+
+    /**
+     * @struct BatchResult ydecoder.h
+     *
+     * @brief Holds the outcome of decoding a batch of articles, with one array per value.
+     *
+     * Entry i of each array belongs to article i of the batch, so a scan over one value, such as the status of every
+     * article, reads memory that is laid out one entry after the other. The arrays keep their memory from one batch to
+     * the next, so a BatchResult that is used for every batch stops allocating once it has seen the largest batch.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct BatchResult{
+        vector<DecoderStatus::Status> status; /**< The status of each article, as in DecodeResult */
+        vector<uint64_t> part; /**< The part value from the header, 0 if the article is not a part of a multipart file */
+        vector<uint64_t> begin; /**< The begin value from the part header, counting from 1 */
+        vector<uint64_t> end; /**< The end value from the part header */
+        vector<uint8_t> crc_ok; /**< 1 if the data matches the pcrc32 in the trailer, or the crc32 if the article holds a whole file */
+        vector<size_t> offset; /**< Where the decoded data of each article starts in @p output */
+        vector<size_t> length; /**< The number of bytes of decoded data of each article */
+        const char *output; /**< The buffer the decoded data was written to */
+
+        BatchResult() : output( NULL ){}
+
+        /**
+         * @return The number of articles in the batch.
+         */
+        size_t size() const { return status.size(); }
+
+        /**
+         * @return The decoded data of article @p i.
+         */
+        const char* data( size_t i ) const { return output + offset[i]; }
+    };
+
     /**
      * @class YDecoder ydecoder.h
      *
@@ -214,19 +335,224 @@ namespace ydecoder{
 
             /**
              * Helper function the does the same as the above funtion, except it accepts a list of files. This allows you to decode
-             * a list of multipart files in one call, for example. You can pass more than one file to the function, it will sort the
-             * list into distinct files and arrange them in memory.
+             * all the parts of a multipart file in one call. The parts may be given in any order; they are read and decoded in
+             * parallel, and the data of each part is placed at the offset given by its part header. Each part is checked
+             * against its pcrc32, and once all parts are decoded the file is checked against the crc32 from the trailers.
+             * Parts that belong to a different file than the first part are skipped. Unless the input is mapped, the parts are
+             * read in batches through io_uring where the kernel supports it, and the decoded parts are written the same way.
              *
              * @param input
+             *      The yencoded files to decode.
              *
              * @param decoding
+             *      If set to STRICT then decoding fails if a part can't be read or parsed. If this is set to FORCE then
+             *      such parts are skipped and their range of the file is left filled with 0's.
              *
              * @return
+             *      The status of the decoder after the decoding operation is finished, combining the status of all the parts.
              */
             DecoderStatus::Status decode( const vector<string>& input, const DecodingOption::Option &decoding = DecodingOption::STRICT );
 
+            /**
+             * Decode a single yencoded article that is already in memory. No files are read, and the decoded data is written
+             * into one contiguous buffer. Unlike the file based functions, this does not add the data to the file being
+             * assembled by the decoder; each call stands on its own, so it is safe to use for unrelated articles.
+             *
+             * @param input
+             *      The article to decode. Anything before the \c =ybegin line is skipped.
+             *
+             * @param length
+             *      The number of bytes in @p input.
+             *
+             * @param output
+             *      The buffer to write the decoded data to. If this is NULL, the data is written to a buffer owned by the decoder,
+             *      which stays valid until the next call to this function or to decodeBatch().
+             *
+             * @param capacity
+             *      The size of @p output. The part size given in the header is always enough; if the buffer fills up before the end
+             *      of the data is reached, the status will have the SIZE_MISMATCH flag set.
+             *
+             * @param decoding
+             *      If set to STRICT then decoding stops at the first malformed header or a missing trailer. If this is set to FORCE
+             *      then the decoder will decode whatever data it can find.
+             *
+             * @return
+             *      The header and trailer values, the location and size of the decoded data and the status of the decoder.
+             */
+            DecodeResult decode( const char *input, size_t length, char *output = NULL, size_t capacity = 0,
+                                 const DecodingOption::Option &decoding = DecodingOption::STRICT );
+
+            /**
+             * Decode a single yencoded article in place. Decoding never produces more bytes than it consumes, so the decoded
+             * data is written over the encoded data it comes from, starting where the encoded data starts, just after the
+             * header. Nothing is allocated and no buffer besides @p buffer is touched, so this is the cheapest way to decode
+             * an article that is already in a buffer of your own, at the cost of the encoded data. The header is left as it
+             * is, so the name in @p result stays valid for as long as @p buffer does.
+             *
+             * @param buffer The article to decode. Anything before the \c =ybegin line is skipped.
+             *
+             * @param length The number of bytes in @p buffer.
+             *
+             * @param result Receives the header and trailer values, the location of the decoded data within @p buffer and the
+             * status of the decoder, as for the function above.
+             *
+             * @param decoding As for the function above.
+             *
+             * @return The number of bytes of decoded data, or 0 if the article couldn't be decoded.
+             */
+            size_t decodeInPlace( char *buffer, size_t length, DecodeResult &result,
+                                  const DecodingOption::Option &decoding = DecodingOption::STRICT );
+
+            /**
+             * Decode a batch of unrelated articles that are already in memory, in one call. Each article is decoded as by
+             * decode() with a buffer, and the decoded data of all of them is written one after the other to a single output
+             * buffer. The setup of a call, such as taking the output buffer and adding to the performance counters, is
+             * done once for the whole batch, and no signals are sent for the articles, so the cost per article comes down
+             * to scanning and decoding it. Look at the status of each article in @p results instead:
+             *
+             * @code
+             * decoder.decodeBatch( articles, count, results );
+             *
+             * for( size_t i = 0; i < results.size(); i++ )
+             *     if( results.status[i] == DecoderStatus::SUCCESS )
+             *         store( results.part[i], results.data( i ), results.length[i] );
+             * @endcode
+             *
+             * @param articles The articles to decode.
+             *
+             * @param count The number of articles.
+             *
+             * @param results Receives the values of each article. Its arrays are resized to @p count entries.
+             *
+             * @param output The buffer to write the decoded data to. If this is NULL, the data is written to a buffer owned
+             * by the decoder, which stays valid until the next call to this function or to decode() with a buffer.
+             *
+             * @param capacity The size of @p output. As decoding never produces more bytes than it consumes, the combined
+             * length of the articles is always enough. An article that no longer fits has the SIZE_MISMATCH flag set.
+             *
+             * @param decoding As for decode() with a buffer. An article that can't be decoded has the FAILED flag set, and
+             * the rest of the batch is decoded all the same.
+             *
+             * @return The status flags of all the articles combined.
+             */
+            DecoderStatus::Status decodeBatch( const ArticleSpan *articles, size_t count, BatchResult &results, char *output = NULL,
+                                               size_t capacity = 0, const DecodingOption::Option &decoding = DecodingOption::STRICT );
+
+            /**
+             * Set how the input files are read. With MAPPED, each file is mapped into memory and the headers are scanned
+             * and the data decoded straight from the mapping, which avoids copying every line and is much faster for large
+             * files holding many articles. With PIPELINED, reading, decoding and writing run on separate threads at the same
+             * time: one thread reads the file in blocks of 1 MB and finds the headers and trailers, the threads set with
+             * setThreads() decode the blocks, and one more thread copies the decoded data to memory or writes it to the
+             * output directory, so a single large file decodes at about the speed the disk delivers it. The stages hand the
+             * blocks on through lock-free rings, and only a few blocks per decoder thread are in flight, so a slow stage
+             * holds up the others instead of letting the memory use grow. The data of each part is written out as it is
+             * decoded, before its pcrc32 has been checked. The default is STREAM.
+             *
+             * PIPELINED only affects decode() with a single file, as decode() with a list of files already works on its
+             * parts in parallel, and it is not used while a journal is kept.
+             *
+             * @param mode The input mode used by the following calls to decode().
+             */
+            void setInputMode( const InputMode::Mode &mode );
+
+            /**
+             * Set the format of the articles passed to the functions that decode an article in memory. With NNTP, the
+             * articles can be decoded straight from the buffer an NNTP \c BODY response was received into: the dot
+             * stuffing is undone by the decode kernel in the same pass as the yenc decoding, and the end of the data is
+             * found in that pass too, instead of scanning for the trailer first. The consumed count of the result then
+             * runs up to and including the line holding a single dot that terminates the response, so the next response
+             * in the buffer starts right after it. This is also the case when the response holds no article, or an article
+             * without a trailer. The default is PLAIN.
+             *
+             * @param format The format used by the following calls to decode() with a buffer, and to decodeInPlace().
+             */
+            void setArticleFormat( const ArticleFormat::Format &format );
+
+            /**
+             * Set the number of threads used to decode the parts of a multipart file, or the blocks of a file with the
+             * PIPELINED input mode.
+             *
+             * @param count The number of threads. 0, the default, uses one thread per processor.
+             */
+            void setThreads( unsigned int count );
+
+            /**
+             * Write the decoded data straight to disk instead of keeping it in memory. Once the header of a file has been read,
+             * the file is created in @p path and preallocated to the size given in the header, and the data of each part is
+             * written at its offset in the file as soon as it is decoded and its pcrc32 checks out. Parts that fail the check
+             * are only written when decoding with FORCE. This keeps the memory use bounded by the size of a part instead of
+             * the size of the file.
+             *
+             * Call this function before decoding the first part of a file. The setting stays in effect for all following files.
+             *
+             * @param path The directory to write the decoded files to. It is created if it doesn't exist. Pass NULL to keep the
+             * decoded data in memory again, which is the default.
+             *
+             * @return \b true if the directory can be written to, \b false if it can't, in which case the data is kept in memory.
+             */
+            bool setOutputDirectory( const char *path );
+
+            /**
+             * Keep a journal of the parts written to the output directory, so a decode that is interrupted, for example
+             * because the process was restarted, can be resumed without decoding everything again. The journal is kept
+             * next to the decoded file, with \c .yjournal appended to its name, and records the range and the crc32 of
+             * each part once its data has reached the disk. When a file with a journal is decoded again, the data
+             * already in the file is kept, and parts whose range was recorded with the crc32 given in their trailer are
+             * skipped without being decoded. The crc32 of the whole file is worked out from the recorded part crcs, so
+             * the file is checked as a whole even if only the missing parts are passed to decode() the second time.
+             * The journal is deleted by write() once it covers the whole file.
+             *
+             * This only applies to files written straight to disk with setOutputDirectory(). While a journal is kept, a
+             * single file passed to decode() is mapped whatever the input mode, as the trailer of a part has to be read
+             * before the part is decoded.
+             *
+             * @param enabled \b true to keep a journal, \b false to stop keeping one, which is the default.
+             */
+            void setJournal( bool enabled );
+
+            /**
+             * Set the pool the buffers of the decoder are taken from. The buffers the decoder needs, such as the buffer an
+             * article in memory is decoded to when no output buffer is passed, the buffer input files are read through
+             * and the blocks of data written to disk, as well as the strings from the headers, are taken from the pool
+             * and kept from one article to the next. The strings are taken back all at once by initialize(). So once the
+             * decoder has seen the largest article and header it is going to see, decoding one article after another no
+             * longer allocates any memory.
+             *
+             * Each decoder has a pool of its own. Decoders that are used on the same thread can share a pool instead, so
+             * they keep one set of buffers between them, for example the pool of the thread:
+             *
+             * @code
+             * decoder.setBufferPool( &ybuffer::BufferPool::local() );
+             * @endcode
+             *
+             * A pool is not thread safe, so a shared pool must only be used by decoders on one thread, and must outlive
+             * them. The buffers already taken go back to the pool they came from.
+             *
+             * @param buffers The pool to take buffers from, or NULL to go back to the pool of the decoder.
+             */
+            void setBufferPool( ybuffer::BufferPool *buffers );
+
+            /**
+             * Set the most memory the decoded data of a file may take. Once the data of a file grows beyond @p limit, it is
+             * moved to a temporary file in @p directory, and from then on the data is decoded through a fixed size buffer and
+             * written to the temporary file one block at a time, so the memory use stays flat no matter how large the file is.
+             * write() then copies the temporary file to its destination, again one block at a time. Files written straight
+             * to disk with setOutputDirectory() are decoded one block at a time as well once a part is larger than the limit.
+             *
+             * While a limit is set, decode() maps the parts of a multipart file instead of reading them, so only the parts
+             * being decoded are held in memory.
+             *
+             * @param limit The limit in bytes. 0, the default, keeps the whole file in memory however large it is.
+             *
+             * @param directory The directory for the temporary file. NULL uses \c $TMPDIR, or \c /var/tmp if that isn't set.
+             */
+            void setMemoryLimit( uint64_t limit, const char *directory = NULL );
+
             /**
              * Write the decoded data to a file. This function should only be called once all the neccessary files have been decoded.
+             * If an output directory was set with setOutputDirectory(), the data is already on disk; this only closes the file,
+             * and @p path is ignored.
              *
              * @param path The path to save the data to. The filename obtained by the decoder from the yencoded file(s) will be appended
              * to this.
@@ -235,6 +561,19 @@ namespace ydecoder{
              */
             bool write( const char *path );
 
+            /**
+             * @return The performance counters of the decoder: how many articles and bytes it has decoded, what it found
+             * wrong with them, and how long it spent on their headers, their data and writing them out. The counters are
+             * always kept, and can be read from any thread while the decoder is at work. ystats::global() returns the
+             * totals of all the decoders in the process.
+             */
+            ystats::Stats stats() const;
+
+            /**
+             * Set the performance counters of the decoder back to 0.
+             */
+            void resetStats();
+
             //Signals
             /**
              * Signal you can connect to to track the progress of the decoder
@@ -262,23 +601,177 @@ namespace ydecoder{
             signal<void, string> debug;
 
         private:
+            /**
+             * Where the data of a part went and its crc32, to work out the crc32 of the file from.
+             */
+            struct PartCrc{
+                uint64_t offset, length;
+                uint32_t crc;
+            };
+
             //Variables
             const unsigned char escaped, magic;
             string read_buffer;
-            stringstream data;
-            int crc, pcrc;
-            crc_32_type crc_val, pcrc_val;
-            int line;
-            char* name;
-            int part;
-            int part_size, size;
-            int total_parts;
+            string data;
+            uint32_t crc, pcrc;
+            ycrc32::Crc32 crc_val, pcrc_val;
+            vector<PartCrc> part_crcs;
+            uint64_t part_crc_bytes;
+            uint64_t line;
+            boost::string_view name;
+            ybuffer::BufferPool own_buffers;
+            ybuffer::Buffer output_buffer, stream_buffer;
+            ybuffer::Arena headers;
+            ystats::Counters counters;
+            string write_buffer;
+            uint64_t part;
+            uint64_t part_begin;
+            uint64_t part_size, size;
+            uint64_t total_parts;
+            unsigned int threads;
+            ythreadpool::ThreadPool *pool;
+            yio::IoEngine *io;
+            yjournal::PartJournal *journal;
+            ypipeline::Pipeline *pipeline;
+            bool journaling;
+            string output_directory;
+            int output_fd;
+            InputMode::Mode input_mode;
+            ArticleFormat::Format article_format;
+            uint64_t memory_limit;
+            string spill_directory;
+            bool spilled;
+
+            //Functions
+            DecoderStatus::Status parseHeader( istream *in, const DecodingOption::Option &decoding = DecodingOption::STRICT );
+            DecoderStatus::Status parseTrailer( uint64_t length, const DecodingOption::Option &decoding = DecodingOption::STRICT );
+            static const char* scanHeader( const char *input, size_t length, const DecodingOption::Option &decoding,
+                                           DecodeResult &result, bool nntp );
+            static const char* scanArticle( const char *input, size_t length, const DecodingOption::Option &decoding,
+                                            DecodeResult &result, const char **body_end, yfile::MappedFile *file = NULL );
+            DecoderStatus::Status decodeMapped( const string &input, const DecodingOption::Option &decoding );
+            DecoderStatus::Status decodePipelined( const string &input, const DecodingOption::Option &decoding );
+            bool checkDirectory( const filesystem::path &p );
+            bool openOutput();
+            void closeOutput();
+            bool resumePart( DecodeResult &result ) const;
+            void recordPart( const DecodeResult &result );
+            void commitJournal();
+            bool journalCrc( ycrc32::Crc32 &file_crc ) const;
+            void addPartCrc( uint64_t offset, uint32_t checksum, uint64_t length );
+            bool fileCrc( ycrc32::Crc32 &file_crc );
+            void reportResult( const DecodeResult &result );
+            bool fitsInMemory( uint64_t length ) const;
+            bool startSpill();
+            bool growData( uint64_t length );
+            static void decodeBody( const char *body, const char *body_end, char *output, size_t capacity, DecodeResult &result );
+            static bool decodeNntp( const char *input, size_t length, const char *body, char *output, size_t capacity,
+                                    const DecodingOption::Option &decoding, DecodeResult &result );
+            static bool decodeBlocks( const char *body, const char *body_end, int fd, uint64_t offset, uint64_t capacity,
+                                      char *buffer, DecodeResult &result, uint64_t &write_time, yfile::MappedFile *file = NULL );
+    };
+
+    /**
+     * @class YStreamDecoder ydecoder.h
+     *
+     * @brief The YStreamDecoder class decodes a single article as it arrives.
+     *
+     * Where YDecoder needs the complete article before it can start, this class is fed the article in chunks
+     * of any size, for example as they are read from a socket, and decodes the data of each chunk straight away.
+     * Escape characters, line endings and header or trailer lines that are split over two chunks are carried over
+     * to the next call of feed(). Once the last chunk has been fed, call finish() to check the data against the
+     * trailer:
+     *
+     * @code
+     * YStreamDecoder decoder;
+     *
+     * while( ( length = recv( socket, buffer, sizeof( buffer ), 0 ) ) > 0 )
+     *     decoder.feed( buffer, length );
+     *
+     * DecodeResult result = decoder.finish();
+     * @endcode
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     *
+     * @see YDecoder
+     */
+    class YStreamDecoder : public trackable
+    {
+        public:
+            //Functions
+            YStreamDecoder( const DecodingOption::Option &decoding = DecodingOption::STRICT );
+            ~YStreamDecoder();
+
+            /**
+             * Prepare the decoder for the next article. The decoded data of the previous article is discarded.
+             */
+            void reset();
+
+            /**
+             * Feed the next chunk of the article to the decoder. Anything before the \c =ybegin line and after the
+             * \c =yend line is ignored.
+             *
+             * @param input The chunk of the article.
+             *
+             * @param length The number of bytes in @p input.
+             *
+             * @return \b false if decoding has failed, in which case any further data is ignored, otherwise \b true.
+             */
+            bool feed( const char *input, size_t length );
+
+            /**
+             * Finish decoding the article, and check the decoded data against the header and trailer.
+             *
+             * @return The header and trailer values, the decoded data and the status of the decoder. The name and the data
+             * are owned by the decoder and stay valid until the next call to reset().
+             */
+            DecodeResult finish();
+
+            /**
+             * @return \b true once the trailer of the article has been fed to the decoder.
+             */
+            bool done() const;
+
+            //Signals
+            /**
+             * Signal you can connect to to recieve warnings from the decoder
+             */
+            signal<void, string> warning;
+
+            /**
+             * Signal you can connect to to recieve errors from the decoder
+             */
+            signal<void, string> error;
+
+        private:
+            enum State{
+                HEADER, /**< Looking for the =ybegin line */
+                PART, /**< Reading the =ypart line */
+                BODY, /**< Decoding data */
+                TRAILER, /**< Reading the =yend line */
+                DONE, /**< The trailer has been read */
+                FAILED /**< Decoding failed */
+            };
+
+            //Variables
+            static const size_t max_line = 1024;
+            const DecodingOption::Option decoding;
+            State state;
+            DecodeResult result;
+            char header_line[max_line];
+            char line_buffer[max_line];
+            size_t line_length;
+            bool line_start, escape, pending_escape;
+            vector<char> output;
+            size_t output_length;
+            ycrc32::Crc32 checksum;
 
             //Functions
-            const char* getAttribute( const char *attr );
-            char* getName();
-            DecoderStatus::Status parseHeader( filesystem::ifstream *in, const DecodingOption::Option &decoding = DecodingOption::STRICT );
-            DecoderStatus::Status parseTrailer( const stringstream &write_stream, const DecodingOption::Option &decoding = DecodingOption::STRICT );
+            const char* readLine( const char *input, const char *end, bool *complete );
+            const char* readTag( const char *input, const char *end, const char *tag, bool *matched );
+            const char* decodeData( const char *input, const char *end );
+            void decodeChunk( const char *input, size_t chunk );
+            void startBody();
     };
 }
 
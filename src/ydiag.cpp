@@ -0,0 +1,56 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include "ydiag.h"
+
+namespace ydiag{
+
+    LogLevel::Level current_level = LogLevel::DEBUGGING;
+
+    void setLevel( LogLevel::Level level )
+    {
+        current_level = level;
+    }
+
+    LogLevel::Level level()
+    {
+        return current_level;
+    }
+
+    void emit( sigc::signal<void, std::string> &signal, const char *format, ... )
+    {
+        char buffer[512];
+        va_list args;
+        va_start( args, format );
+        int length = vsnprintf( buffer, sizeof( buffer ), format, args );
+        va_end( args );
+
+        if( length < 0 )
+            return;
+
+        if( static_cast<size_t>( length ) >= sizeof( buffer ) )
+            length = sizeof( buffer ) - 1;
+
+        signal.emit( std::string( buffer, length ) );
+    }
+
+}
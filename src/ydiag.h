@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ydiag
+ * The namespace for the diagnostics of the library, ie. the messages sent through the error, warning, message
+ * and debug signals of the encoder and decoder.
+ */
+#ifndef YDIAG_YDIAG_H
+#define YDIAG_YDIAG_H
+
+#include <sigc++/sigc++.h>
+#include <string>
+
+/**
+ * The most detailed level of diagnostics compiled into the library, as a value of ydiag::LogLevel::Level.
+ * Messages above this level are removed by the compiler, so they cost nothing at all. Defaults to
+ * DEBUGGING, ie. everything; set it with the YENC_LOG_LEVEL cache variable of CMake.
+ */
+#ifndef YENC_LOG_LEVEL
+#define YENC_LOG_LEVEL 4
+#endif
+
+namespace ydiag{
+
+    namespace LogLevel{
+            enum Level{
+                NONE = 0, /**< No diagnostics at all */
+                ERRORS, /**< Only errors */
+                WARNINGS, /**< Errors and warnings */
+                MESSAGES, /**< Errors, warnings and informational messages */
+                DEBUGGING /**< Everything, including debug information */
+            };
+    }
+
+    /**
+     * Set the most detailed level of diagnostics sent by the library at runtime. Messages above this level are
+     * dropped before they are formatted. This applies to all encoders and decoders, so set it once at startup.
+     *
+     * @param level The most detailed level to send. The default is DEBUGGING.
+     */
+    void setLevel( LogLevel::Level level );
+
+    /**
+     * @return The level set by setLevel().
+     */
+    LogLevel::Level level();
+
+    extern LogLevel::Level current_level;
+
+    /**
+     * @return \b true if messages of @p level are compiled in and enabled at runtime.
+     */
+    inline bool enabled( LogLevel::Level level )
+    {
+        return level <= YENC_LOG_LEVEL && level <= current_level;
+    }
+
+    /**
+     * Format a message printf style into a buffer on the stack, and send it through @p signal. Messages longer
+     * than 512 bytes are truncated. Use the YENC_ERROR, YENC_WARNING, YENC_MESSAGE and YENC_DEBUG macros rather
+     * than calling this directly, so that nothing is formatted unless the message is wanted.
+     */
+    void emit( sigc::signal<void, std::string> &signal, const char *format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+}
+
+/**
+ * Send a message through a signal, if @p level is enabled and something is connected to the signal. The
+ * arguments are only evaluated if the message is sent.
+ */
+#define YENC_LOG( level, signal, ... ) \
+    do{ \
+        if( ydiag::enabled( level ) && !( signal ).empty() ) \
+            ydiag::emit( signal, __VA_ARGS__ ); \
+    }while( false )
+
+#define YENC_ERROR( signal, ... ) YENC_LOG( ydiag::LogLevel::ERRORS, signal, __VA_ARGS__ )
+#define YENC_WARNING( signal, ... ) YENC_LOG( ydiag::LogLevel::WARNINGS, signal, __VA_ARGS__ )
+#define YENC_MESSAGE( signal, ... ) YENC_LOG( ydiag::LogLevel::MESSAGES, signal, __VA_ARGS__ )
+#define YENC_DEBUG( signal, ... ) YENC_LOG( ydiag::LogLevel::DEBUGGING, signal, __VA_ARGS__ )
+
+#endif
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ycrc32.h"
+#include "ydispatch.h"
+#include "ykernel.h"
+
+namespace ydispatch{
+
+    namespace{
+
+        const char* const level_names[] = { "scalar", "sse2", "ssse3", "sse4.1", "avx2", "avx512" };
+
+        CpuLevel::Level detect()
+        {
+            __builtin_cpu_init();
+
+            if( !__builtin_cpu_supports( "sse2" ) )
+                return CpuLevel::SCALAR;
+
+            if( !__builtin_cpu_supports( "ssse3" ) )
+                return CpuLevel::SSE2;
+
+            if( !__builtin_cpu_supports( "sse4.1" ) || !__builtin_cpu_supports( "pclmul" ) )
+                return CpuLevel::SSSE3;
+
+            if( !__builtin_cpu_supports( "avx2" ) )
+                return CpuLevel::SSE41;
+
+            if( !__builtin_cpu_supports( "avx512f" ) || !__builtin_cpu_supports( "avx512bw" ) )
+                return CpuLevel::AVX2;
+
+            return CpuLevel::AVX512;
+        }
+
+        /**
+         * @return The highest level the processor supports, or the level named by YENC_FORCE_LEVEL if that is lower.
+         */
+        CpuLevel::Level initialLevel()
+        {
+            const char *name = getenv( "YENC_FORCE_LEVEL" );
+            CpuLevel::Level level;
+
+            if( name && parseLevel( name, level ) && level < supported() )
+                return level;
+
+            return supported();
+        }
+
+        /**
+         * The level in use. This is set up the first time it is needed rather than with the other globals, since the
+         * kernels pick their versions while the globals of the library are being set up.
+         */
+        CpuLevel::Level& current()
+        {
+            static CpuLevel::Level level = initialLevel();
+            return level;
+        }
+
+    }
+
+    CpuLevel::Level supported()
+    {
+        static const CpuLevel::Level level = detect();
+        return level;
+    }
+
+    CpuLevel::Level level()
+    {
+        return current();
+    }
+
+    CpuLevel::Level setLevel( CpuLevel::Level level )
+    {
+        current() = level < supported() ? level : supported();
+        ykernel::select();
+        ycrc32::select();
+        return current();
+    }
+
+    const char* levelName( CpuLevel::Level level )
+    {
+        return level >= CpuLevel::SCALAR && level <= CpuLevel::AVX512 ? level_names[level] : "unknown";
+    }
+
+    bool parseLevel( const char *name, CpuLevel::Level &level )
+    {
+        for( int i = CpuLevel::SCALAR; i <= CpuLevel::AVX512; i++ ){
+
+            if( strcmp( name, level_names[i] ) == 0 ){
+                level = static_cast<CpuLevel::Level>( i );
+                return true;
+            }
+
+        }
+
+        return false;
+    }
+
+    Kernels kernels()
+    {
+        Kernels names = { ykernel::decodeKernel(), ykernel::encodeKernel(), ycrc32::kernel() };
+        return names;
+    }
+
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ydispatch
+ * The namespace for choosing the kernels that suit the processor the library runs on. The decode, encode and crc32
+ * kernels each come in several versions, for different generations of x86 processors. When the library is loaded,
+ * the fastest version of each that the processor supports is picked, so one build runs well on every machine.
+ */
+#ifndef YDISPATCH_YDISPATCH_H
+#define YDISPATCH_YDISPATCH_H
+
+#include <stddef.h>
+
+namespace ydispatch{
+
+    /**
+     * The instruction set levels the kernels are written for. Each level includes all the levels below it.
+     */
+    namespace CpuLevel{
+            enum Level{
+                SCALAR = 0, /**< Plain C++, for any processor */
+                SSE2, /**< SSE2 */
+                SSSE3, /**< SSSE3 */
+                SSE41, /**< SSE4.1 and PCLMULQDQ */
+                AVX2, /**< AVX2 */
+                AVX512 /**< AVX-512F and AVX-512BW */
+            };
+    }
+
+    /**
+     * @struct Kernels ydispatch.h
+     *
+     * @brief The names of the kernels in use, such as "avx2" or "scalar".
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct Kernels{
+        const char *decode; /**< The kernel used to decode data */
+        const char *encode; /**< The kernel used to encode data */
+        const char *crc32; /**< The kernel used to calculate crc32 values */
+    };
+
+    /**
+     * @return The highest level the processor supports.
+     */
+    CpuLevel::Level supported();
+
+    /**
+     * @return The level the kernels are picked for. This is the level returned by supported(), unless a lower level
+     * was set with setLevel() or with the \c YENC_FORCE_LEVEL environment variable, which takes the names returned by
+     * levelName(), eg. \c YENC_FORCE_LEVEL=ssse3.
+     */
+    CpuLevel::Level level();
+
+    /**
+     * Pick the kernels for a lower level than the processor supports, to test or benchmark the kernels of that level.
+     * Levels above the one the processor supports are lowered to it. Call this before encoding or decoding anything,
+     * since the kernels are swapped without any locking.
+     *
+     * @return The level set.
+     */
+    CpuLevel::Level setLevel( CpuLevel::Level level );
+
+    /**
+     * @return The name of @p level, ie. "scalar", "sse2", "ssse3", "sse4.1", "avx2" or "avx512".
+     */
+    const char* levelName( CpuLevel::Level level );
+
+    /**
+     * Look up a level by the name returned by levelName().
+     *
+     * @return \b true if @p name is the name of a level, in which case it is stored in @p level, otherwise \b false.
+     */
+    bool parseLevel( const char *name, CpuLevel::Level &level );
+
+    /**
+     * @return The names of the kernels in use.
+     */
+    Kernels kernels();
+
+    /**
+     * One version of a kernel, and the level it needs. The versions of a kernel are kept in a table ordered from the
+     * highest level down to the scalar version, which has to come last.
+     */
+    template<typename Function>
+    struct Kernel{
+        CpuLevel::Level level;
+        const char *name;
+        Function function;
+    };
+
+    /**
+     * @return The first kernel in @p kernels that the current level allows.
+     */
+    template<typename Function, size_t N>
+    const Kernel<Function>* choose( const Kernel<Function> ( &kernels )[N] )
+    {
+        for( size_t i = 0; i + 1 < N; i++ ){
+
+            if( kernels[i].level <= level() )
+                return &kernels[i];
+
+        }
+
+        return &kernels[N - 1];
+    }
+
+}
+
+#endif
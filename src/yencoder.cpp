@@ -18,17 +18,377 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <boost/filesystem/fstream.hpp>
+#include "ycrc32.h"
+#include "ydiag.h"
 #include "yencoder.h"
+#include "yfile.h"
+#include "ykernel.h"
+#include "ythreadpool.h"
 
 namespace yencoder {
 
-    YEncoder::YEncoder()
+    namespace{
+
+        /**
+        * The amount of data encoded at a time, small enough that its crc32 is taken while it is still in the cache.
+        */
+        const size_t encode_block = 64 * 1024;
+
+        /**
+        * Room for the header, part and trailer lines of an article, apart from the name.
+        */
+        const size_t line_room = 256;
+
+        /**
+        * The state of one part while encoding a multipart post in parallel.
+        */
+        struct PartJob{
+            uint64_t begin;
+            size_t length;
+            unsigned int number;
+            uint32_t pcrc;
+            size_t crc_offset;
+            string file;
+            bool written;
+        };
+
+        /**
+        * Split @p size bytes of data into parts of @p part_size bytes.
+        */
+        vector<PartJob> splitParts( uint64_t size, uint64_t part_size )
+        {
+            vector<PartJob> jobs( size ? ( size + part_size - 1 ) / part_size : 1 );
+
+            for( size_t i = 0; i < jobs.size(); i++ ){
+                jobs[i].begin = i * part_size + 1;
+                jobs[i].length = min( part_size, size - i * part_size );
+                jobs[i].number = i + 1;
+                jobs[i].pcrc = 0;
+                jobs[i].crc_offset = 0;
+                jobs[i].written = false;
+            }
+
+            return jobs;
+        }
+
+        /**
+        * Encode one part of a multipart post into @p output, which must have room for
+        * line_room + @p name.length() + ykernel::encodedSizeBound( @p job.length, @p line_length ) bytes. The crc32 of
+        * the whole file isn't known until all the parts are done, so the trailer gets a placeholder for it, which is
+        * filled in by patchCrc().
+        *
+        * @return The size of the encoded article.
+        */
+        size_t encodePart( const char *input, PartJob &job, size_t total, uint64_t size, const string &name,
+                           unsigned int line_length, char *output )
+        {
+            char *out = output;
+            out += sprintf( out, "=ybegin part=%u total=%llu line=%u size=%llu name=", job.number,
+                            static_cast<unsigned long long>( total ), line_length, static_cast<unsigned long long>( size ) );
+            memcpy( out, name.data(), name.length() );
+            out += name.length();
+            out += sprintf( out, "\r\n=ypart begin=%llu end=%llu\r\n", static_cast<unsigned long long>( job.begin ),
+                            static_cast<unsigned long long>( job.begin + job.length - 1 ) );
+
+            const unsigned char *src = reinterpret_cast<const unsigned char*>( input );
+            unsigned int column = 0;
+            uint32_t crc = 0;
+
+            for( size_t done = 0; done < job.length; ){
+                size_t chunk = min( job.length - done, encode_block );
+                crc = ycrc32::crc32( crc, src + done, chunk );
+                out += ykernel::encode( src + done, chunk, reinterpret_cast<unsigned char*>( out ), line_length, column,
+                                        done + chunk == job.length );
+                done += chunk;
+            }
+
+            if( job.length ){
+                *out++ = '\r';
+                *out++ = '\n';
+            }
+
+            job.pcrc = crc;
+            out += sprintf( out, "=yend size=%llu part=%u pcrc32=%08x crc32=", static_cast<unsigned long long>( job.length ),
+                            job.number, crc );
+            job.crc_offset = out - output;
+            memcpy( out, "00000000\r\n", 10 );
+            return out + 10 - output;
+        }
+
+        /**
+        * Write @p crc into the placeholder left for it by encodePart().
+        */
+        void patchCrc( char *placeholder, uint32_t crc )
+        {
+            char digits[9];
+            snprintf( digits, sizeof( digits ), "%08x", crc );
+            memcpy( placeholder, digits, 8 );
+        }
+
+        /**
+        * Combine the pcrc32 values of the parts into the crc32 of the whole file.
+        */
+        uint32_t combineCrc( const vector<PartJob> &jobs )
+        {
+            ycrc32::Crc32 crc;
+
+            for( size_t i = 0; i < jobs.size(); i++ )
+                crc.combine( jobs[i].pcrc, jobs[i].length );
+
+            return crc.checksum();
+        }
+
+    }
+
+    YEncoder::YEncoder( unsigned int line_length )
+        : line_length( line_length ? line_length : 128 ), crc_value( 0 ), threads( 0 ), pool( NULL )
     {
     }
 
 
     YEncoder::~YEncoder()
     {
+        delete pool;
+    }
+
+    EncoderStatus::Status YEncoder::encode( const string &input, const char *path )
+    {
+        boost::filesystem::ifstream in( input, ios::in | ios::binary );
+
+        if( !in.is_open() ){
+            YENC_ERROR( error, "Failed to open file %s", input.c_str() );
+            return EncoderStatus::FAILED;
+        }
+
+        in.seekg( 0, ios::end );
+        string data( static_cast<size_t>( in.tellg() ), '\0' );
+        in.seekg( 0, ios::beg );
+
+        if( !in.read( &data[0], data.length() ) ){
+            YENC_ERROR( error, "Failed to read file %s", input.c_str() );
+            return EncoderStatus::FAILED;
+        }
+
+        in.close();
+
+        string name = input.substr( input.find_last_of( '/' ) + 1 );
+        string output;
+
+        if( encode( data.data(), data.length(), name, output ) != EncoderStatus::SUCCESS )
+            return EncoderStatus::FAILED;
+
+        boost::filesystem::path p( path );
+        p /= name + ".yenc";
+        boost::filesystem::ofstream out( p, ios::out | ios::binary );
+
+        if( !out.is_open() ){
+            YENC_ERROR( error, "Failed to open %s for writing, aborting!", p.string().c_str() );
+            return EncoderStatus::FAILED;
+        }
+
+        YENC_DEBUG( debug, "Writing encoded data to %s", p.string().c_str() );
+
+        if( !out.write( output.data(), output.length() ) ){
+            YENC_ERROR( error, "Failed to write to %s", p.string().c_str() );
+            return EncoderStatus::FAILED;
+        }
+
+        return EncoderStatus::SUCCESS;
+    }
+
+    EncoderStatus::Status YEncoder::encode( const char *input, size_t length, const string &name, string &output )
+    {
+        if( !checkName( name ) )
+            return EncoderStatus::FAILED;
+
+        crc_value = ycrc32::crc32( 0, input, length );
+
+        char header[64], trailer[64];
+        int header_length = snprintf( header, sizeof( header ), "=ybegin line=%u size=%llu name=", line_length,
+                                      static_cast<unsigned long long>( length ) );
+        int trailer_length = snprintf( trailer, sizeof( trailer ), "=yend size=%llu crc32=%08x\r\n",
+                                       static_cast<unsigned long long>( length ), crc_value );
+
+        //Size the output for the worst case up front, so the data can be encoded straight into it
+        output.resize( header_length + name.length() + 2 + ykernel::encodedSizeBound( length, line_length ) + 2 + trailer_length );
+        char *out = &output[0];
+
+        memcpy( out, header, header_length );
+        out += header_length;
+        memcpy( out, name.data(), name.length() );
+        out += name.length();
+        *out++ = '\r';
+        *out++ = '\n';
+
+        if( length ){
+            unsigned int column = 0;
+            out += ykernel::encode( reinterpret_cast<const unsigned char*>( input ), length,
+                                    reinterpret_cast<unsigned char*>( out ), line_length, column, true );
+            *out++ = '\r';
+            *out++ = '\n';
+        }
+
+        memcpy( out, trailer, trailer_length );
+        out += trailer_length;
+        output.resize( out - output.data() );
+        return EncoderStatus::SUCCESS;
+    }
+
+    EncoderStatus::Status YEncoder::encode( const string &input, const char *path, uint64_t part_size )
+    {
+        string name = input.substr( input.find_last_of( '/' ) + 1 );
+
+        if( !checkName( name ) )
+            return EncoderStatus::FAILED;
+
+        if( !part_size ){
+            YENC_ERROR( error, "Invalid part size, unable to encode!" );
+            return EncoderStatus::FAILED;
+        }
+
+        yfile::MappedFile file;
+
+        if( !file.map( input ) ){
+            YENC_ERROR( error, "Failed to open file %s", input.c_str() );
+            return EncoderStatus::FAILED;
+        }
+
+        vector<PartJob> jobs = splitParts( file.size(), part_size );
+        int digits = max( 3, snprintf( NULL, 0, "%llu", static_cast<unsigned long long>( jobs.size() ) ) );
+        ythreadpool::ThreadPool &workers = threadPool();
+        const size_t total = jobs.size();
+        const unsigned int line = line_length;
+
+        for( size_t i = 0; i < jobs.size(); i++ ){
+            PartJob *job = &jobs[i];
+            char number[32];
+            snprintf( number, sizeof( number ), ".%0*u.yenc", digits, job->number );
+            boost::filesystem::path p( path );
+            p /= name + number;
+            job->file = p.string();
+
+            workers.schedule( [job, &file, &name, total, line]{
+                const char *data = file.data() + job->begin - 1;
+                vector<char> buffer( line_room + name.length() + ykernel::encodedSizeBound( job->length, line ) );
+                size_t article = encodePart( data, *job, total, file.size(), name, line, buffer.data() );
+                file.release( data, data + job->length );
+                int fd = yfile::createFile( job->file, article );
+                job->written = fd >= 0 && yfile::writeAt( fd, buffer.data(), article, 0 );
+
+                if( fd >= 0 && close( fd ) != 0 )
+                    job->written = false;
+
+            } );
+        }
+
+        workers.wait();
+        crc_value = combineCrc( jobs );
+        EncoderStatus::Status status = EncoderStatus::SUCCESS;
+
+        //Every trailer carries the crc32 of the whole file, which is only known now
+        for( size_t i = 0; i < jobs.size(); i++ ){
+            PartJob &job = jobs[i];
+            char value[8];
+            patchCrc( value, crc_value );
+
+            if( !job.written ){
+                YENC_ERROR( error, "Failed to write %s", job.file.c_str() );
+                status = EncoderStatus::FAILED;
+                continue;
+            }
+
+            int fd = open( job.file.c_str(), O_WRONLY );
+
+            if( fd < 0 || !yfile::writeAt( fd, value, sizeof( value ), job.crc_offset ) || close( fd ) != 0 ){
+                YENC_ERROR( error, "Failed to write to %s : %s", job.file.c_str(), strerror( errno ) );
+                status = EncoderStatus::FAILED;
+            }
+
+        }
+
+        YENC_DEBUG( debug, "Encoded %s in %llu parts, crc32 %08x", name.c_str(), static_cast<unsigned long long>( jobs.size() ),
+                    crc_value );
+        return status;
+    }
+
+    EncoderStatus::Status YEncoder::encode( const char *input, size_t length, const string &name, size_t part_size,
+                                            vector<string> &output )
+    {
+        if( !checkName( name ) )
+            return EncoderStatus::FAILED;
+
+        if( !part_size ){
+            YENC_ERROR( error, "Invalid part size, unable to encode!" );
+            return EncoderStatus::FAILED;
+        }
+
+        vector<PartJob> jobs = splitParts( length, part_size );
+        ythreadpool::ThreadPool &workers = threadPool();
+        const size_t total = jobs.size();
+        const unsigned int line = line_length;
+        output.assign( jobs.size(), string() );
+
+        for( size_t i = 0; i < jobs.size(); i++ ){
+            PartJob *job = &jobs[i];
+            string *article = &output[i];
+
+            workers.schedule( [job, article, input, length, &name, total, line]{
+                article->resize( line_room + name.length() + ykernel::encodedSizeBound( job->length, line ) );
+                article->resize( encodePart( input + job->begin - 1, *job, total, length, name, line, &( *article )[0] ) );
+            } );
+        }
+
+        workers.wait();
+        crc_value = combineCrc( jobs );
+
+        for( size_t i = 0; i < jobs.size(); i++ )
+            patchCrc( &output[i][jobs[i].crc_offset], crc_value );
+
+        return EncoderStatus::SUCCESS;
+    }
+
+    void YEncoder::setThreads( unsigned int count )
+    {
+        if( count != threads ){
+            delete pool;
+            pool = NULL;
+            threads = count;
+        }
+    }
+
+    uint32_t YEncoder::crc() const
+    {
+        return crc_value;
+    }
+
+    /**
+    * Check that @p name can be put in a header.
+    *
+    * @return \b true if it can, otherwise \b false.
+    */
+    bool YEncoder::checkName( const string &name )
+    {
+        if( name.empty() || name.find_first_of( "\r\n" ) != string::npos ){
+            YENC_ERROR( error, "Invalid name, unable to encode!" );
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+    * @return The thread pool the parts are encoded on, which is started the first time it is needed.
+    */
+    ythreadpool::ThreadPool& YEncoder::threadPool()
+    {
+        if( !pool )
+            pool = new ythreadpool::ThreadPool( threads );
+
+        return *pool;
     }
 
 }
@@ -24,8 +24,27 @@
 #ifndef YENCODER_YENCODER_H
 #define YENCODER_YENCODER_H
 
+#include <sigc++/sigc++.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ythreadpool{
+    class ThreadPool;
+}
+
+using namespace sigc;
+using namespace std;
+
 namespace yencoder {
 
+    namespace EncoderStatus{
+            enum Status{
+                SUCCESS = 0, /**< The encoding succeeded */
+                FAILED = 1 /**< The encoding failed */
+            };
+    }
+
     /**
      * @class YEncoder yencoder.h
      *
@@ -36,12 +55,136 @@ namespace yencoder {
      * interface that makes use of libsigc++ so that you can connect your
      * program to the signals emitted by the library.
      *
+     * @code
+     * YEncoder encoder( 128 );
+     * encoder.error.connect( sigc::ptr_fun( print ) );
+     *
+     * if( encoder.encode( "archive.rar", get_current_dir_name() ) != EncoderStatus::SUCCESS )
+     *     return EXIT_FAILURE;
+     * @endcode
+     *
      * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     *
+     * @see YDecoder
      */
-    class YEncoder{
+    class YEncoder : public trackable
+    {
         public:
-            YEncoder();
+            //Functions
+            /**
+             * @param line_length The number of characters per line of encoded data. Lines holding an escaped character
+             * in the last column are one character longer, as allowed by the specifications.
+             */
+            YEncoder( unsigned int line_length = 128 );
             ~YEncoder();
+
+            /**
+             * Encode a file and write the encoded article to a directory. The article is named after the file,
+             * with \c .yenc appended.
+             *
+             * @param input The file to encode.
+             *
+             * @param path The directory to write the encoded article to.
+             *
+             * @return The status of the encoder after the encoding operation is finished.
+             */
+            EncoderStatus::Status encode( const string &input, const char *path );
+
+            /**
+             * Encode data held in memory as a single part article, including the \c =ybegin and \c =yend lines.
+             *
+             * @param input The data to encode.
+             *
+             * @param length The number of bytes in @p input.
+             *
+             * @param name The name to put in the header.
+             *
+             * @param output Receives the encoded article. Its previous contents are replaced.
+             *
+             * @return The status of the encoder after the encoding operation is finished.
+             */
+            EncoderStatus::Status encode( const char *input, size_t length, const string &name, string &output );
+
+            /**
+             * Encode a file as a multipart post, and write each part to a directory as an article of its own. The articles
+             * are named after the file, with the part number and \c .yenc appended, as in \c archive.rar.001.yenc.
+             *
+             * The parts are encoded in parallel, each into its own buffer, straight from a memory mapping of the file, so
+             * only the parts being encoded are held in memory. Every trailer carries the crc32 of the whole file as well as
+             * the pcrc32 of its part. The file crc32 is combined from the part crcs once all parts are done, and filled in
+             * afterwards, so the data is only read once.
+             *
+             * @param input The file to encode.
+             *
+             * @param path The directory to write the encoded articles to.
+             *
+             * @param part_size The number of bytes of data in each part. The last part holds whatever is left.
+             *
+             * @return The status of the encoder after the encoding operation is finished.
+             */
+            EncoderStatus::Status encode( const string &input, const char *path, uint64_t part_size );
+
+            /**
+             * Encode data held in memory as a multipart post. This works like the function above, except that the articles
+             * are returned in @p output instead of being written to disk.
+             *
+             * @param input The data to encode.
+             *
+             * @param length The number of bytes in @p input.
+             *
+             * @param name The name to put in the headers.
+             *
+             * @param part_size The number of bytes of data in each part.
+             *
+             * @param output Receives the encoded articles, in order of their part numbers. Its previous contents are replaced.
+             *
+             * @return The status of the encoder after the encoding operation is finished.
+             */
+            EncoderStatus::Status encode( const char *input, size_t length, const string &name, size_t part_size, vector<string> &output );
+
+            /**
+             * Set the number of threads used to encode the parts of a multipart post.
+             *
+             * @param count The number of threads. 0, the default, uses one thread per processor.
+             */
+            void setThreads( unsigned int count );
+
+            /**
+             * @return The crc32 of the data encoded by the last call to encode().
+             */
+            uint32_t crc() const;
+
+            //Signals
+            /**
+             * Signal you can connect to to recieve messages from the encoder
+             */
+            signal<void, string> message;
+
+            /**
+             * Signal you can connect to to recieve warnings from the encoder
+             */
+            signal<void, string> warning;
+
+            /**
+             * Signal you can connect to to recieve errors from the encoder
+             */
+            signal<void, string> error;
+
+            /**
+             * Signal you can connect to to recieve debug information from the encoder
+             */
+            signal<void, string> debug;
+
+        private:
+            //Variables
+            const unsigned int line_length;
+            uint32_t crc_value;
+            unsigned int threads;
+            ythreadpool::ThreadPool *pool;
+
+            //Functions
+            bool checkName( const string &name );
+            ythreadpool::ThreadPool& threadPool();
     };
 
 }
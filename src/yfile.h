@@ -0,0 +1,267 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace yfile
+ * The namespace for the low level file access shared by the decoders: memory mapped input, and positional output.
+ */
+#ifndef YFILE_YFILE_H
+#define YFILE_YFILE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace yfile{
+
+    /**
+     * @class MappedFile yfile.h
+     *
+     * @brief A read only mapping of a whole file.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class MappedFile
+    {
+        public:
+            MappedFile() : address( NULL ), length( 0 ){}
+            ~MappedFile(){ unmap(); }
+
+            /**
+             * Map a file, and tell the kernel it will be read sequentially so it reads ahead aggressively.
+             *
+             * @return \b true if the file was mapped, otherwise \b false.
+             */
+            bool map( const std::string &path )
+            {
+                unmap();
+                int fd = open( path.c_str(), O_RDONLY );
+
+                if( fd < 0 )
+                    return false;
+
+                struct stat info;
+
+                if( fstat( fd, &info ) != 0 ){
+                    close( fd );
+                    return false;
+                }
+
+                length = info.st_size;
+
+                if( length ){
+                    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+                    address = mmap( NULL, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+                    if( address == MAP_FAILED ){
+                        address = NULL;
+                        length = 0;
+                        close( fd );
+                        return false;
+                    }
+
+                    madvise( address, length, MADV_SEQUENTIAL );
+#ifdef MADV_HUGEPAGE
+                    madvise( address, length, MADV_HUGEPAGE );
+#endif
+                }
+
+                close( fd );
+                return true;
+            }
+
+            void unmap()
+            {
+                if( address )
+                    munmap( address, length );
+
+                address = NULL;
+                length = 0;
+            }
+
+            /**
+             * Drop the pages before @p position from memory, so a long sequential scan doesn't hold on to the whole file.
+             */
+            void release( const char *position )
+            {
+                release( data(), position );
+            }
+
+            /**
+             * Drop the pages that lie entirely between @p begin and @p end from memory. They are read back in from the
+             * page cache if they are touched again.
+             */
+            void release( const char *begin, const char *end )
+            {
+                size_t page = sysconf( _SC_PAGESIZE );
+                size_t first = ( begin - data() + page - 1 ) & ~( page - 1 );
+                size_t last = ( end - data() ) & ~( page - 1 );
+
+                if( last > first )
+                    madvise( static_cast<char*>( address ) + first, last - first, MADV_DONTNEED );
+
+            }
+
+            const char* data() const { return static_cast<const char*>( address ); }
+            size_t size() const { return length; }
+
+        private:
+            void *address;
+            size_t length;
+
+            MappedFile( const MappedFile& );
+            MappedFile& operator=( const MappedFile& );
+    };
+
+    /**
+     * Create a file for the decoded data, and reserve @p size bytes for it, so the parts can be written at their
+     * offsets without fragmenting the file. Filesystems that can't reserve space just get the size set.
+     *
+     * @return The file descriptor, or -1 if the file couldn't be created, with errno set.
+     */
+    inline int createFile( const std::string &path, uint64_t size )
+    {
+        int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+        if( fd >= 0 && size > 0 && posix_fallocate( fd, 0, size ) != 0 && ftruncate( fd, size ) != 0 ){
+            int err = errno;
+            close( fd );
+            errno = err;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    /**
+     * Open a file created by createFile() to write more of its data, as when an interrupted decode is resumed. Unlike
+     * createFile(), the data already in the file is kept.
+     *
+     * @return The file descriptor, or -1 if the file couldn't be opened or isn't @p size bytes long, with errno set.
+     */
+    inline int openFile( const std::string &path, uint64_t size )
+    {
+        int fd = open( path.c_str(), O_WRONLY );
+
+        if( fd < 0 )
+            return -1;
+
+        struct stat info;
+        int err = fstat( fd, &info ) != 0 ? errno : static_cast<uint64_t>( info.st_size ) != size ? EINVAL : 0;
+
+        if( err ){
+            close( fd );
+            errno = err;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    /**
+     * Create an anonymous file in @p directory to hold data that doesn't fit in memory, and reserve @p size bytes
+     * for it. The file is unlinked straight away, so it disappears when it is closed.
+     *
+     * @return The file descriptor, open for reading and writing, or -1 if the file couldn't be created, with errno set.
+     */
+    inline int createTemporary( const std::string &directory, uint64_t size )
+    {
+        std::string path = directory + "/ydecoder.XXXXXX";
+        std::vector<char> name( path.begin(), path.end() );
+        name.push_back( 0 );
+        int fd = mkstemp( name.data() );
+
+        if( fd < 0 )
+            return -1;
+
+        unlink( name.data() );
+
+        if( size > 0 && posix_fallocate( fd, 0, size ) != 0 && ftruncate( fd, size ) != 0 ){
+            int err = errno;
+            close( fd );
+            errno = err;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    /**
+     * Write a buffer to a file at the given offset. This doesn't use the file position, so it is safe to call from
+     * several threads at once.
+     *
+     * @return \b true if the whole buffer was written, otherwise \b false.
+     */
+    inline bool writeAt( int fd, const char *buffer, size_t length, uint64_t offset )
+    {
+        while( length ){
+            ssize_t written = pwrite( fd, buffer, length, offset );
+
+            if( written < 0 ){
+
+                if( errno == EINTR )
+                    continue;
+
+                return false;
+            }
+
+            buffer += written;
+            length -= written;
+            offset += written;
+        }
+
+        return true;
+    }
+
+    /**
+     * Copy the first @p length bytes of one file to another, one block at a time, so the copy takes the same amount of
+     * memory no matter how large the files are.
+     *
+     * @return \b true if everything was copied, otherwise \b false.
+     */
+    inline bool copyFile( int from, int to, uint64_t length, size_t block_size = 1 << 20 )
+    {
+        std::vector<char> block( block_size );
+
+        for( uint64_t offset = 0; offset < length; ){
+            ssize_t count = pread( from, block.data(), std::min<uint64_t>( block_size, length - offset ), offset );
+
+            if( count < 0 && errno == EINTR )
+                continue;
+
+            if( count <= 0 || !writeAt( to, block.data(), count, offset ) )
+                return false;
+
+            offset += count;
+        }
+
+        return true;
+    }
+
+}
+
+#endif
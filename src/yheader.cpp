@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <string.h>
+#include "yheader.h"
+
+namespace yheader{
+
+    namespace{
+
+        /**
+         * A keyword and its value, as found in a header or trailer line.
+         */
+        struct Token{
+            const char *key, *key_end;
+            const char *value, *value_end;
+
+            bool is( const char *keyword ) const
+            {
+                size_t len = strlen( keyword );
+                return static_cast<size_t>( key_end - key ) == len && memcmp( key, keyword, len ) == 0;
+            }
+        };
+
+        /**
+         * Read the next keyword=value pair of a line, skipping anything in between that isn't one.
+         *
+         * @return The position after the value, or NULL if there are no more pairs in the line.
+         */
+        const char* nextToken( const char *text, const char *end, Token &token )
+        {
+            while( text < end ){
+
+                while( text < end && *text == ' ' )
+                    text++;
+
+                token.key = text;
+
+                while( text < end && *text != '=' && *text != ' ' )
+                    text++;
+
+                if( text < end && *text == '=' ){
+                    token.key_end = text;
+                    token.value = ++text;
+
+                    while( text < end && *text != ' ' )
+                        text++;
+
+                    token.value_end = text;
+                    return text;
+                }
+
+            }
+
+            return NULL;
+        }
+
+        uint64_t parseDecimal( const char *text, const char *end )
+        {
+            uint64_t value = 0;
+
+            for( ; text < end && *text >= '0' && *text <= '9'; text++ )
+                value = value * 10 + ( *text - '0' );
+
+            return value;
+        }
+
+        uint32_t parseHex( const char *text, const char *end )
+        {
+            uint32_t value = 0;
+
+            for( ; text < end; text++ ){
+
+                if( *text >= '0' && *text <= '9' )
+                    value = ( value << 4 ) | ( *text - '0' );
+                else if( ( *text | 0x20 ) >= 'a' && ( *text | 0x20 ) <= 'f' )
+                    value = ( value << 4 ) | ( ( *text | 0x20 ) - 'a' + 10 );
+                else
+                    break;
+
+            }
+
+            return value;
+        }
+
+        inline bool isBlank( char c )
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        /**
+         * Check that a line starts with @p prefix, and strip the line ending.
+         *
+         * @return The start of the keywords following the prefix, or NULL if the line doesn't start with @p prefix.
+         */
+        const char* startLine( const char *text, const char *&eol, const char *prefix )
+        {
+            size_t len = strlen( prefix );
+
+            while( eol > text && ( eol[-1] == '\r' || eol[-1] == '\n' ) )
+                eol--;
+
+            if( static_cast<size_t>( eol - text ) < len || memcmp( text, prefix, len ) != 0 )
+                return NULL;
+
+            //The keyword itself has to end here, so =yendx isn't taken for =yend
+            if( text + len < eol && text[len] != ' ' )
+                return NULL;
+
+            return text + len;
+        }
+    }
+
+    bool parseBegin( const char *text, const char *eol, YencHeader &header )
+    {
+        if( !( text = startLine( text, eol, "=ybegin" ) ) )
+            return false;
+
+        Token token;
+
+        while( ( text = nextToken( text, eol, token ) ) ){
+
+            if( token.is( "name" ) ){
+                //The name is the last keyword and runs to the end of the line, spaces included
+                const char *name = token.value;
+                const char *name_end = eol;
+
+                while( name < name_end && isBlank( *name ) )
+                    name++;
+
+                while( name_end > name && isBlank( name_end[-1] ) )
+                    name_end--;
+
+                header.name = boost::string_view( name, name_end - name );
+                break;
+            }else if( token.is( "line" ) ){
+                header.line = parseDecimal( token.value, token.value_end );
+            }else if( token.is( "size" ) ){
+                header.size = parseDecimal( token.value, token.value_end );
+            }else if( token.is( "part" ) ){
+                header.part = parseDecimal( token.value, token.value_end );
+            }else if( token.is( "total" ) ){
+                header.total = parseDecimal( token.value, token.value_end );
+            }
+
+        }
+
+        return true;
+    }
+
+    bool parsePart( const char *text, const char *eol, YencHeader &header )
+    {
+        if( !( text = startLine( text, eol, "=ypart" ) ) )
+            return false;
+
+        Token token;
+
+        while( ( text = nextToken( text, eol, token ) ) ){
+
+            if( token.is( "begin" ) )
+                header.begin = parseDecimal( token.value, token.value_end );
+            else if( token.is( "end" ) )
+                header.end = parseDecimal( token.value, token.value_end );
+
+        }
+
+        return true;
+    }
+
+    bool parseEnd( const char *text, const char *eol, YencTrailer &trailer )
+    {
+        if( !( text = startLine( text, eol, "=yend" ) ) )
+            return false;
+
+        Token token;
+
+        while( ( text = nextToken( text, eol, token ) ) ){
+
+            if( token.is( "size" ) )
+                trailer.size = parseDecimal( token.value, token.value_end );
+            else if( token.is( "part" ) )
+                trailer.part = parseDecimal( token.value, token.value_end );
+            else if( token.is( "crc32" ) )
+                trailer.crc = parseHex( token.value, token.value_end );
+            else if( token.is( "pcrc32" ) )
+                trailer.pcrc = parseHex( token.value, token.value_end );
+
+        }
+
+        return true;
+    }
+
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace yheader
+ * The namespace for the parser of the yenc header and trailer lines.
+ */
+#ifndef YHEADER_YHEADER_H
+#define YHEADER_YHEADER_H
+
+#include <stdint.h>
+#include <boost/utility/string_view.hpp>
+
+namespace yheader{
+
+    /**
+     * @struct YencHeader yheader.h
+     *
+     * @brief The values of the \c =ybegin line, and of the \c =ypart line of a multipart article.
+     *
+     * Values that are missing from the lines are 0. The name points into the parsed line, so it is only valid as
+     * long as the line is.
+     */
+    struct YencHeader{
+        uint64_t line; /**< The line length */
+        uint64_t size; /**< The size of the whole file */
+        uint64_t part; /**< The part number, or 0 if this is not a multipart article */
+        uint64_t total; /**< The total number of parts */
+        uint64_t begin; /**< The offset of the first byte of the part, counting from 1 */
+        uint64_t end; /**< The offset of the last byte of the part */
+        boost::string_view name; /**< The name of the file, with surrounding whitespace removed */
+
+        YencHeader() : line( 0 ), size( 0 ), part( 0 ), total( 0 ), begin( 0 ), end( 0 ){}
+    };
+
+    /**
+     * @struct YencTrailer yheader.h
+     *
+     * @brief The values of the \c =yend line. Values that are missing from the line are 0.
+     */
+    struct YencTrailer{
+        uint64_t size; /**< The size of the data of the article */
+        uint64_t part; /**< The part number */
+        uint32_t crc; /**< The crc32 of the whole file */
+        uint32_t pcrc; /**< The crc32 of the data of the article */
+
+        YencTrailer() : size( 0 ), part( 0 ), crc( 0 ), pcrc( 0 ){}
+    };
+
+    /**
+     * Parse a \c =ybegin line. The line is read in a single pass, without allocating any memory. The name is the
+     * rest of the line after \c name=, as the specification requires it to be the last keyword.
+     *
+     * @param text The start of the line.
+     *
+     * @param eol The end of the line. A trailing carriage return or linefeed is ignored.
+     *
+     * @param header Receives the values of the line. The values of the \c =ypart line are left alone.
+     *
+     * @return \b true if the line is a \c =ybegin line, otherwise \b false.
+     */
+    bool parseBegin( const char *text, const char *eol, YencHeader &header );
+
+    /**
+     * Parse a \c =ypart line into the begin and end values of @p header.
+     *
+     * @return \b true if the line is a \c =ypart line, otherwise \b false.
+     */
+    bool parsePart( const char *text, const char *eol, YencHeader &header );
+
+    /**
+     * Parse a \c =yend line.
+     *
+     * @return \b true if the line is a \c =yend line, otherwise \b false.
+     */
+    bool parseEnd( const char *text, const char *eol, YencTrailer &trailer );
+
+}
+
+#endif
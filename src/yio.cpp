@@ -0,0 +1,666 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#include "yfile.h"
+#include "yio.h"
+
+using namespace std;
+
+namespace yio{
+
+    namespace{
+
+        /**
+         * The most data handed to the kernel in a single read or write. Linux transfers a little under 2 GB per call.
+         */
+        const size_t max_transfer = 1 << 30;
+
+        /**
+         * Read a whole file with blocking calls.
+         *
+         * @return 0 if the file was read, otherwise the errno value of the failure.
+         */
+        int readFile( const string &path, vector<char> &contents )
+        {
+            int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+
+            if( fd < 0 )
+                return errno;
+
+            struct stat info;
+            size_t done = 0;
+            int err = 0;
+
+            if( fstat( fd, &info ) != 0 ){
+                err = errno;
+            }else{
+                contents.resize( info.st_size );
+
+                while( done < contents.size() ){
+                    ssize_t count = read( fd, contents.data() + done, contents.size() - done );
+
+                    if( count < 0 && errno == EINTR )
+                        continue;
+
+                    if( count < 0 ){
+                        err = errno;
+                        break;
+                    }
+
+                    if( !count )
+                        break;
+
+                    done += count;
+                }
+            }
+
+            close( fd );
+            contents.resize( err ? 0 : done );
+            return err;
+        }
+
+    }
+
+#ifdef HAVE_IO_URING
+
+    /**
+     * An io_uring instance, set up with the raw system calls so the library doesn't depend on liburing.
+     */
+    struct IoEngine::Ring{
+        /**
+         * The kind of request, kept in the low bits of the user data of each request.
+         */
+        enum Kind{ OPEN, STAT, READ, CLOSE, WRITE };
+
+        struct Write{
+            int fd;
+            const char *buffer;
+            size_t length;
+            uint64_t offset;
+        };
+
+        int fd;
+        unsigned int entries;
+        unsigned int queued; /**< Requests in the submission queue that haven't been handed to the kernel */
+        unsigned int in_flight; /**< Requests handed to the kernel that haven't completed */
+        void *sq_map, *cq_map;
+        size_t sq_map_size, cq_map_size;
+        io_uring_sqe *sqes;
+        unsigned int *sq_tail, *sq_mask, *sq_array;
+        unsigned int *cq_head, *cq_tail, *cq_mask;
+        io_uring_cqe *cqes;
+        vector<Write> writes;
+        vector<unsigned int> free_writes;
+
+        Ring() : fd( -1 ), entries( 0 ), queued( 0 ), in_flight( 0 ), sq_map( NULL ), cq_map( NULL ), sqes( NULL ){}
+
+        ~Ring()
+        {
+            if( sqes )
+                munmap( sqes, entries * sizeof( io_uring_sqe ) );
+
+            if( cq_map && cq_map != sq_map )
+                munmap( cq_map, cq_map_size );
+
+            if( sq_map )
+                munmap( sq_map, sq_map_size );
+
+            if( fd >= 0 )
+                close( fd );
+
+        }
+
+        /**
+         * Create the ring and map its queues.
+         *
+         * @return \b true if the kernel has io_uring and supports all the requests the engine makes, otherwise \b false.
+         */
+        bool setup( unsigned int depth )
+        {
+            io_uring_params params;
+            memset( &params, 0, sizeof( params ) );
+            //Opening a file takes two requests at once
+            fd = syscall( __NR_io_uring_setup, max( depth, 2u ), &params );
+
+            if( fd < 0 )
+                return false;
+
+            entries = params.sq_entries;
+            sq_map_size = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+            cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+
+            if( params.features & IORING_FEAT_SINGLE_MMAP )
+                sq_map_size = cq_map_size = max( sq_map_size, cq_map_size );
+
+            sq_map = mmap( NULL, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+
+            if( sq_map == MAP_FAILED ){
+                sq_map = NULL;
+                return false;
+            }
+
+            if( params.features & IORING_FEAT_SINGLE_MMAP ){
+                cq_map = sq_map;
+            }else if( ( cq_map = mmap( NULL, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING ) ) == MAP_FAILED ){
+                cq_map = NULL;
+                return false;
+            }
+
+            void *map = mmap( NULL, entries * sizeof( io_uring_sqe ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+
+            if( map == MAP_FAILED )
+                return false;
+
+            char *sq = static_cast<char*>( sq_map );
+            char *cq = static_cast<char*>( cq_map );
+            sqes = static_cast<io_uring_sqe*>( map );
+            sq_tail = reinterpret_cast<unsigned int*>( sq + params.sq_off.tail );
+            sq_mask = reinterpret_cast<unsigned int*>( sq + params.sq_off.ring_mask );
+            sq_array = reinterpret_cast<unsigned int*>( sq + params.sq_off.array );
+            cq_head = reinterpret_cast<unsigned int*>( cq + params.cq_off.head );
+            cq_tail = reinterpret_cast<unsigned int*>( cq + params.cq_off.tail );
+            cq_mask = reinterpret_cast<unsigned int*>( cq + params.cq_off.ring_mask );
+            cqes = reinterpret_cast<io_uring_cqe*>( cq + params.cq_off.cqes );
+            writes.resize( entries );
+
+            for( unsigned int i = entries; i > 0; i-- )
+                free_writes.push_back( i - 1 );
+
+            return probe();
+        }
+
+        /**
+         * Ask the kernel which requests it supports. Kernels older than 5.6 can't open, stat or close files through
+         * the ring, and don't support probing either.
+         */
+        bool probe()
+        {
+            const int needed[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITE, IORING_OP_CLOSE };
+            vector<uint64_t> buffer( ( sizeof( io_uring_probe ) + IORING_OP_LAST * sizeof( io_uring_probe_op ) ) / sizeof( uint64_t ) + 1 );
+            io_uring_probe *ops = reinterpret_cast<io_uring_probe*>( buffer.data() );
+
+            if( syscall( __NR_io_uring_register, fd, IORING_REGISTER_PROBE, ops, IORING_OP_LAST ) < 0 )
+                return false;
+
+            for( size_t i = 0; i < sizeof( needed ) / sizeof( needed[0] ); i++ ){
+
+                if( needed[i] > ops->last_op || !( ops->ops[needed[i]].flags & IO_URING_OP_SUPPORTED ) )
+                    return false;
+
+            }
+
+            return true;
+        }
+
+        /**
+         * @return The number of requests that can be queued before some have to complete.
+         */
+        unsigned int room() const
+        {
+            return entries - queued - in_flight;
+        }
+
+        /**
+         * Start a request in the next free entry of the submission queue. Fill in the rest of it, then call push().
+         */
+        io_uring_sqe* prepare( int opcode, int file, uint64_t index, Kind kind )
+        {
+            unsigned int tail = *sq_tail;
+            io_uring_sqe *sqe = &sqes[tail & *sq_mask];
+            memset( sqe, 0, sizeof( *sqe ) );
+            sqe->opcode = opcode;
+            sqe->fd = file;
+            sqe->user_data = ( index << 3 ) | kind;
+            sq_array[tail & *sq_mask] = tail & *sq_mask;
+            return sqe;
+        }
+
+        void push()
+        {
+            __atomic_store_n( sq_tail, *sq_tail + 1, __ATOMIC_RELEASE );
+            queued++;
+        }
+    };
+
+    /**
+     * The files being read by readFiles().
+     */
+    struct IoEngine::Batch{
+        struct File{
+            int fd;
+            int error;
+            int buffer; /**< The index of the registered buffer the file is read into, or -1 */
+            size_t done;
+            struct statx info;
+        };
+
+        vector<File> files;
+        const vector<string> *paths;
+        vector<vector<char> > *contents;
+        size_t first;
+        unsigned int pending;
+    };
+
+#else
+
+    struct IoEngine::Ring{};
+    struct IoEngine::Batch{};
+
+#endif
+
+    IoEngine::IoEngine( unsigned int depth )
+        : ring( NULL ), batch( NULL ), error( 0 ), fixed_buffers( true )
+    {
+#ifdef HAVE_IO_URING
+        if( !getenv( "YENC_NO_IO_URING" ) ){
+            ring = new Ring;
+
+            if( !ring->setup( depth ) ){
+                delete ring;
+                ring = NULL;
+            }
+        }
+#endif
+    }
+
+    IoEngine::~IoEngine()
+    {
+        flush();
+        delete ring;
+    }
+
+    bool IoEngine::async() const
+    {
+        return ring != NULL;
+    }
+
+    void IoEngine::readFiles( const vector<string> &paths, vector<vector<char> > &contents, vector<int> &errors )
+    {
+        contents.assign( paths.size(), vector<char>() );
+        errors.assign( paths.size(), 0 );
+
+#ifdef HAVE_IO_URING
+        if( ring ){
+            std::lock_guard<std::mutex> lock( mutex );
+
+            size_t count = ring->entries / 2;
+
+            for( size_t first = 0; first < paths.size(); first += count )
+                readBatch( paths, first, min( count, paths.size() - first ), contents, errors );
+
+            return;
+        }
+#endif
+
+        for( size_t i = 0; i < paths.size(); i++ )
+            errors[i] = readFile( paths[i], contents[i] );
+
+    }
+
+    void IoEngine::write( int fd, const char *buffer, size_t length, uint64_t offset )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        while( length ){
+            size_t chunk = min( length, max_transfer );
+
+            bool queued = false;
+
+#ifdef HAVE_IO_URING
+            if( ring && reserve( 1 ) ){
+                unsigned int slot = ring->free_writes.back();
+                Ring::Write request = { fd, buffer, chunk, offset };
+                ring->free_writes.pop_back();
+                ring->writes[slot] = request;
+                queueWrite( slot );
+                queued = true;
+            }
+#endif
+
+            if( !queued && !yfile::writeAt( fd, buffer, chunk, offset ) && !error )
+                error = errno;
+
+            buffer += chunk;
+            length -= chunk;
+            offset += chunk;
+        }
+
+#ifdef HAVE_IO_URING
+        //Hand the writes over a few at a time, so the kernel works on them while more are being decoded
+        if( ring && ring->queued >= ring->entries / 4 )
+            submit( 0 );
+#endif
+    }
+
+    bool IoEngine::flush()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+#ifdef HAVE_IO_URING
+        while( ring && ( ring->queued || ring->in_flight ) && submit( 1 ) )
+            ;
+#endif
+
+        int err = error;
+        error = 0;
+
+        if( err ){
+            errno = err;
+            return false;
+        }
+
+        return true;
+    }
+
+#ifdef HAVE_IO_URING
+
+    /**
+     * Open, read and close a batch of files through the ring. The files are opened and their sizes looked up with one
+     * system call, then read into buffers that are registered with the kernel for the batch, so the kernel maps the
+     * buffers once rather than for every read, and finally closed. Call with the mutex held.
+     */
+    void IoEngine::readBatch( const vector<string> &paths, size_t first, size_t count, vector<vector<char> > &contents, vector<int> &errors )
+    {
+        Batch current;
+        Batch::File file = Batch::File();
+        file.fd = -1;
+        file.buffer = -1;
+        current.files.assign( count, file );
+        current.paths = &paths;
+        current.contents = &contents;
+        current.first = first;
+        current.pending = 0;
+        batch = &current;
+        bool failed = !reserve( 2 * count );
+
+        for( size_t i = 0; i < count && !failed; i++ ){
+            const char *path = paths[first + i].c_str();
+            io_uring_sqe *sqe = ring->prepare( IORING_OP_OPENAT, AT_FDCWD, i, Ring::OPEN );
+            sqe->addr = reinterpret_cast<uintptr_t>( path );
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            ring->push();
+            sqe = ring->prepare( IORING_OP_STATX, AT_FDCWD, i, Ring::STAT );
+            sqe->addr = reinterpret_cast<uintptr_t>( path );
+            sqe->len = STATX_SIZE;
+            sqe->off = reinterpret_cast<uintptr_t>( &current.files[i].info );
+            ring->push();
+            current.pending += 2;
+        }
+
+        while( current.pending && !failed )
+            failed = !submit( 1 );
+
+        vector<iovec> buffers;
+
+        for( size_t i = 0; i < count && !failed; i++ ){
+            Batch::File &file = current.files[i];
+
+            if( file.fd < 0 || file.error )
+                continue;
+
+            vector<char> &data = contents[first + i];
+            data.resize( file.info.stx_size );
+
+            if( !data.empty() && data.size() <= max_transfer ){
+                iovec buffer = { data.data(), data.size() };
+                file.buffer = buffers.size();
+                buffers.push_back( buffer );
+            }
+        }
+
+        //The kernel limits how much memory may be registered, so once that fails the reads go to plain buffers
+        bool registered = !failed && fixed_buffers && !buffers.empty() &&
+                          syscall( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size() ) == 0;
+
+        if( !registered ){
+            fixed_buffers = fixed_buffers && buffers.empty();
+
+            for( size_t i = 0; i < count; i++ )
+                current.files[i].buffer = -1;
+
+        }
+
+        for( size_t i = 0; i < count && !failed; i++ ){
+            Batch::File &file = current.files[i];
+
+            if( file.fd < 0 || file.error || contents[first + i].empty() )
+                continue;
+
+            failed = !reserve( 1 );
+
+            if( !failed ){
+                queueRead( i );
+                current.pending++;
+            }
+        }
+
+        while( current.pending && !failed )
+            failed = !submit( 1 );
+
+        if( registered )
+            syscall( __NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0 );
+
+        for( size_t i = 0; i < count; i++ ){
+            Batch::File &file = current.files[i];
+
+            if( file.fd < 0 )
+                continue;
+
+            if( !failed && reserve( 1 ) ){
+                ring->prepare( IORING_OP_CLOSE, file.fd, i, Ring::CLOSE );
+                ring->push();
+                current.pending++;
+            }else{
+                close( file.fd );
+            }
+        }
+
+        while( current.pending && !failed )
+            failed = !submit( 1 );
+
+        for( size_t i = 0; i < count; i++ ){
+            errors[first + i] = failed ? EIO : current.files[i].error;
+
+            if( errors[first + i] )
+                vector<char>().swap( contents[first + i] );
+
+        }
+
+        batch = NULL;
+    }
+
+    /**
+     * Queue the next read of a file in the current batch. Call with the mutex held, and with room in the ring.
+     */
+    void IoEngine::queueRead( size_t index )
+    {
+        Batch::File &file = batch->files[index];
+        vector<char> &data = ( *batch->contents )[batch->first + index];
+        io_uring_sqe *sqe = ring->prepare( file.buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, file.fd, index, Ring::READ );
+        sqe->addr = reinterpret_cast<uintptr_t>( data.data() + file.done );
+        sqe->len = min( data.size() - file.done, max_transfer );
+        sqe->off = file.done;
+
+        if( file.buffer >= 0 )
+            sqe->buf_index = file.buffer;
+
+        ring->push();
+    }
+
+    /**
+     * Queue a write, or what is left of it. Call with the mutex held, and with room in the ring.
+     */
+    void IoEngine::queueWrite( unsigned int slot )
+    {
+        const Ring::Write &request = ring->writes[slot];
+        io_uring_sqe *sqe = ring->prepare( IORING_OP_WRITE, request.fd, slot, Ring::WRITE );
+        sqe->addr = reinterpret_cast<uintptr_t>( request.buffer );
+        sqe->len = request.length;
+        sqe->off = request.offset;
+        ring->push();
+    }
+
+    /**
+     * Wait until there is room in the ring for @p count more requests. Call with the mutex held.
+     *
+     * @return \b false if the ring failed.
+     */
+    bool IoEngine::reserve( unsigned int count )
+    {
+        if( count > ring->entries )
+            return false;
+
+        while( ring->room() < count ){
+
+            if( !submit( 1 ) )
+                return false;
+
+        }
+
+        return true;
+    }
+
+    /**
+     * Hand the queued requests to the kernel, wait until at least @p wait requests have completed, and handle the
+     * requests that have. Call with the mutex held.
+     *
+     * @return \b false if the ring failed, in which case errno is set.
+     */
+    bool IoEngine::submit( unsigned int wait )
+    {
+        for( ;; ){
+            int submitted = syscall( __NR_io_uring_enter, ring->fd, ring->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+
+            if( submitted >= 0 ){
+                ring->queued -= submitted;
+                ring->in_flight += submitted;
+                break;
+            }
+
+            if( errno == EINTR )
+                continue;
+
+            //The kernel is short of resources until some of the requests in flight complete
+            if( ( errno == EAGAIN || errno == EBUSY ) && ring->in_flight ){
+                syscall( __NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+                complete();
+                continue;
+            }
+
+            if( !error )
+                error = errno;
+
+            return false;
+        }
+
+        complete();
+        return true;
+    }
+
+    /**
+     * Handle the completed requests. Reads and writes that stopped short, or were interrupted, are queued again for the
+     * rest of their data. Call with the mutex held.
+     */
+    void IoEngine::complete()
+    {
+        unsigned int head = *ring->cq_head;
+        unsigned int tail = __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE );
+
+        for( ; head != tail; head++ ){
+            const io_uring_cqe &cqe = ring->cqes[head & *ring->cq_mask];
+            Ring::Kind kind = static_cast<Ring::Kind>( cqe.user_data & 7 );
+            size_t index = cqe.user_data >> 3;
+            bool retry = cqe.res == -EINTR || cqe.res == -EAGAIN;
+            int res = cqe.res;
+            ring->in_flight--;
+
+            if( kind == Ring::WRITE ){
+                Ring::Write &request = ring->writes[index];
+
+                if( res > 0 ){
+                    request.buffer += res;
+                    request.length -= res;
+                    request.offset += res;
+                }else if( !retry && !error ){
+                    error = res ? -res : EIO;
+                }
+
+                if( ( res > 0 && request.length ) || retry )
+                    queueWrite( index );
+                else
+                    ring->free_writes.push_back( index );
+
+                continue;
+            }
+
+            Batch::File &file = batch->files[index];
+
+            if( kind == Ring::OPEN ){
+
+                if( res >= 0 )
+                    file.fd = res;
+                else
+                    file.error = -res;
+
+            }else if( kind == Ring::STAT ){
+
+                if( res < 0 && !file.error )
+                    file.error = -res;
+
+            }else if( kind == Ring::READ ){
+                vector<char> &data = ( *batch->contents )[batch->first + index];
+
+                if( res > 0 )
+                    file.done += res;
+                else if( res < 0 && !retry )
+                    file.error = -res;
+
+                //A file that shrank since it was looked up ends early
+                if( !res )
+                    data.resize( file.done );
+
+                if( ( res > 0 && file.done < data.size() ) || retry ){
+                    queueRead( index );
+                    continue;
+                }
+            }
+
+            batch->pending--;
+        }
+
+        __atomic_store_n( ring->cq_head, head, __ATOMIC_RELEASE );
+    }
+
+#endif
+
+}
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace yio
+ * The namespace for the asynchronous file access used by the batch decoders.
+ */
+#ifndef YIO_YIO_H
+#define YIO_YIO_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace yio{
+
+    /**
+     * @class IoEngine yio.h
+     *
+     * @brief Reads and writes files with as few system calls as possible.
+     *
+     * On Linux kernels that have io_uring, requests are queued on a ring shared with the kernel and handed over in
+     * batches, so a whole batch of files is opened, read and closed with a handful of system calls, and writes are
+     * queued while the caller carries on decoding. Where io_uring isn't available, or is disabled by setting the
+     * \c YENC_NO_IO_URING environment variable, the same requests are carried out with ordinary blocking calls.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class IoEngine
+    {
+        public:
+            /**
+             * @param depth The most requests to keep queued at once.
+             */
+            explicit IoEngine( unsigned int depth = 64 );
+
+            /**
+             * Waits for the queued writes to finish.
+             */
+            ~IoEngine();
+
+            /**
+             * @return \b true if the requests go through io_uring, \b false if they fell back to blocking calls.
+             */
+            bool async() const;
+
+            /**
+             * Read a list of whole files into memory. The files are opened, read and closed in batches, and each batch
+             * is read into buffers registered with the kernel once for the whole batch where the kernel allows it.
+             *
+             * @param paths The files to read.
+             *
+             * @param contents Receives the contents of each file.
+             *
+             * @param errors Receives 0 for each file that was read, or the errno value of the failure.
+             */
+            void readFiles( const std::vector<std::string> &paths, std::vector<std::vector<char> > &contents, std::vector<int> &errors );
+
+            /**
+             * Queue a write of @p length bytes to @p fd at @p offset. The write may not happen until flush() is called, and
+             * @p buffer must stay valid until then. This may be called from several threads at once.
+             */
+            void write( int fd, const char *buffer, size_t length, uint64_t offset );
+
+            /**
+             * Wait until all the queued writes have finished.
+             *
+             * @return \b true if everything was written, otherwise \b false, with errno set to the error of the first write
+             * that failed.
+             */
+            bool flush();
+
+        private:
+            struct Ring;
+            struct Batch;
+
+            //Variables
+            Ring *ring;
+            Batch *batch;
+            std::mutex mutex;
+            int error;
+            bool fixed_buffers;
+
+            //Functions
+            void readBatch( const std::vector<std::string> &paths, size_t first, size_t count,
+                            std::vector<std::vector<char> > &contents, std::vector<int> &errors );
+            void queueRead( size_t index );
+            void queueWrite( unsigned int slot );
+            bool reserve( unsigned int count );
+            bool submit( unsigned int wait );
+            void complete();
+
+            IoEngine( const IoEngine& );
+            IoEngine& operator=( const IoEngine& );
+    };
+
+}
+
+#endif
@@ -0,0 +1,255 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "yjournal.h"
+
+using namespace std;
+
+namespace yjournal{
+
+    namespace{
+
+        /**
+         * Parse a record, a line of the form "begin end crc".
+         *
+         * @return \b true if the line from @p text to @p eol is a valid record, otherwise \b false.
+         */
+        bool parseRecord( const char *text, const char *eol, uint64_t &begin, uint64_t &end, uint32_t &crc )
+        {
+            char *next;
+            begin = strtoull( text, &next, 10 );
+
+            if( next == text || *next != ' ' )
+                return false;
+
+            text = next + 1;
+            end = strtoull( text, &next, 10 );
+
+            if( next == text || *next != ' ' )
+                return false;
+
+            text = next + 1;
+            crc = strtoul( text, &next, 16 );
+            return next == eol && next != text && begin && end >= begin;
+        }
+
+        bool writeAll( int fd, const char *buffer, size_t length )
+        {
+            while( length ){
+                ssize_t written = ::write( fd, buffer, length );
+
+                if( written < 0 ){
+
+                    if( errno == EINTR )
+                        continue;
+
+                    return false;
+                }
+
+                buffer += written;
+                length -= written;
+            }
+
+            return true;
+        }
+    }
+
+    PartJournal::PartJournal()
+        : fd( -1 ), size( 0 ), total( 0 )
+    {
+    }
+
+    PartJournal::~PartJournal()
+    {
+        close();
+    }
+
+    bool PartJournal::open( const string &file, uint64_t length )
+    {
+        close();
+        path = file;
+        size = length;
+        fd = ::open( path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+
+        if( fd < 0 )
+            return false;
+
+        //A journal that is empty, unreadable or kept for a file of another size is started afresh
+        if( load() || clear() )
+            return true;
+
+        int err = errno;
+        close();
+        errno = err;
+        return false;
+    }
+
+    void PartJournal::close()
+    {
+        if( fd >= 0 ){
+            ::close( fd );
+            fd = -1;
+        }
+
+        records.clear();
+        pending.clear();
+        total = 0;
+    }
+
+    void PartJournal::remove()
+    {
+        if( fd < 0 )
+            return;
+
+        close();
+        unlink( path.c_str() );
+    }
+
+    bool PartJournal::clear()
+    {
+        records.clear();
+        pending.clear();
+        total = 0;
+
+        if( ftruncate( fd, 0 ) != 0 )
+            return false;
+
+        char header[64];
+        int length = snprintf( header, sizeof( header ), "yjournal size=%llu\n", static_cast<unsigned long long>( size ) );
+        return writeAll( fd, header, length );
+    }
+
+    bool PartJournal::find( uint64_t begin, uint64_t end, uint32_t &crc ) const
+    {
+        map<uint64_t, Record>::const_iterator it = records.find( begin );
+
+        if( it == records.end() || it->second.end != end )
+            return false;
+
+        crc = it->second.crc;
+        return true;
+    }
+
+    void PartJournal::add( uint64_t begin, uint64_t end, uint32_t crc )
+    {
+        insert( begin, end, crc );
+        char line[64];
+        snprintf( line, sizeof( line ), "%llu %llu %08x\n", static_cast<unsigned long long>( begin ),
+                  static_cast<unsigned long long>( end ), crc );
+        pending += line;
+    }
+
+    bool PartJournal::commit( int data )
+    {
+        if( pending.empty() )
+            return true;
+
+        if( fd < 0 ){
+            errno = EBADF;
+            return false;
+        }
+
+        if( fdatasync( data ) != 0 || !writeAll( fd, pending.data(), pending.length() ) )
+            return false;
+
+        pending.clear();
+        return true;
+    }
+
+    uint64_t PartJournal::contiguous( ycrc32::Crc32 &crc ) const
+    {
+        uint64_t covered = 0;
+
+        for( map<uint64_t, Record>::const_iterator it = records.begin(); it != records.end() && it->first == covered + 1; ++it ){
+            crc.combine( it->second.crc, it->second.end - it->first + 1 );
+            covered = it->second.end;
+        }
+
+        return covered;
+    }
+
+    /**
+     * Read the records back from the journal. Reading stops at the first line that isn't a complete record, and
+     * the journal is cut off there, so later records aren't appended to a broken line.
+     *
+     * @return \b true if the journal was kept for a file of the expected size, otherwise \b false.
+     */
+    bool PartJournal::load()
+    {
+        string text;
+        char buffer[65536];
+
+        for( ssize_t count; ( count = pread( fd, buffer, sizeof( buffer ), text.length() ) ) != 0; ){
+
+            if( count < 0 ){
+
+                if( errno == EINTR )
+                    continue;
+
+                return false;
+            }
+
+            text.append( buffer, count );
+        }
+
+        const char *begin = text.c_str();
+        const char *end = begin + text.length();
+        const char *eol = static_cast<const char*>( memchr( begin, '\n', end - begin ) );
+        char header[64];
+        snprintf( header, sizeof( header ), "yjournal size=%llu", static_cast<unsigned long long>( size ) );
+
+        if( !eol || static_cast<size_t>( eol - begin ) != strlen( header ) || memcmp( begin, header, eol - begin ) != 0 )
+            return false;
+
+        const char *line = eol + 1;
+        uint64_t first, last;
+        uint32_t crc;
+
+        for( ; line < end && ( eol = static_cast<const char*>( memchr( line, '\n', end - line ) ) ); line = eol + 1 ){
+
+            if( !parseRecord( line, eol, first, last, crc ) || last > size )
+                break;
+
+            insert( first, last, crc );
+        }
+
+        return line == end || ftruncate( fd, line - begin ) == 0;
+    }
+
+    void PartJournal::insert( uint64_t begin, uint64_t end, uint32_t crc )
+    {
+        map<uint64_t, Record>::iterator it = records.find( begin );
+
+        if( it != records.end() )
+            total -= it->second.end - it->first + 1;
+
+        Record &record = records[begin];
+        record.end = end;
+        record.crc = crc;
+        total += end - begin + 1;
+    }
+
+}
@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace yjournal
+ * The namespace for the journal that lets an interrupted decode pick up where it left off.
+ */
+#ifndef YJOURNAL_YJOURNAL_H
+#define YJOURNAL_YJOURNAL_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include "ycrc32.h"
+
+namespace yjournal{
+
+    /**
+     * @class PartJournal yjournal.h
+     *
+     * @brief Records which ranges of a file being decoded have been written to disk, and their crc32.
+     *
+     * The journal is a text file kept next to the file it describes. The first line holds the size of the file, and
+     * each following line records a range that has been written, counting from 1 like the \c =ypart line, with the
+     * crc32 of its data:
+     *
+     * @code
+     * yjournal size=1048576
+     * 1 524288 8b1a9953
+     * 524289 1048576 0e3dc6cb
+     * @endcode
+     *
+     * Records are only appended once the data they describe has reached the disk, so the journal never claims more
+     * than the file holds, even after a crash. A line cut short by a crash is dropped when the journal is opened again.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class PartJournal
+    {
+        public:
+            PartJournal();
+
+            /**
+             * Closes the journal. Records that haven't been committed are lost.
+             */
+            ~PartJournal();
+
+            /**
+             * Open the journal at @p path for a file of @p size bytes. If the journal exists and was kept for a file of
+             * the same size, its records are read back, otherwise it is started afresh.
+             *
+             * @return \b true if the journal was opened, otherwise \b false, with errno set.
+             */
+            bool open( const std::string &path, uint64_t size );
+
+            /**
+             * Close the journal, leaving the file in place for the next run.
+             */
+            void close();
+
+            /**
+             * Close the journal and delete the file, once the file it describes is complete.
+             */
+            void remove();
+
+            /**
+             * Drop all the records, for when the file they describe turns out to be gone.
+             *
+             * @return \b true if the journal was emptied, otherwise \b false.
+             */
+            bool clear();
+
+            bool isOpen() const { return fd >= 0; }
+
+            /**
+             * @return The number of records.
+             */
+            size_t count() const { return records.size(); }
+
+            /**
+             * @return The number of bytes covered by the records.
+             */
+            uint64_t recorded() const { return total; }
+
+            /**
+             * Look up the range from @p begin to @p end.
+             *
+             * @param crc Receives the crc32 recorded for the range.
+             *
+             * @return \b true if exactly this range has been recorded, otherwise \b false.
+             */
+            bool find( uint64_t begin, uint64_t end, uint32_t &crc ) const;
+
+            /**
+             * Record the range from @p begin to @p end, replacing any earlier record starting at @p begin. The record
+             * isn't written to the journal until commit() is called.
+             */
+            void add( uint64_t begin, uint64_t end, uint32_t crc );
+
+            /**
+             * Write the records added since the last commit to the journal. The data of the file described by the
+             * journal is flushed to disk first, so a record never reaches the disk before its data.
+             *
+             * @param fd The file the records describe.
+             *
+             * @return \b true if the records were written, otherwise \b false, with errno set.
+             */
+            bool commit( int fd );
+
+            /**
+             * Combine the crc32 of the records into @p crc, in order from the start of the file, up to the first gap.
+             *
+             * @return The number of bytes combined.
+             */
+            uint64_t contiguous( ycrc32::Crc32 &crc ) const;
+
+        private:
+            struct Record{
+                uint64_t end;
+                uint32_t crc;
+            };
+
+            //Variables
+            std::string path;
+            int fd;
+            uint64_t size;
+            uint64_t total;
+            std::map<uint64_t, Record> records;
+            std::string pending;
+
+            //Functions
+            bool load();
+            void insert( uint64_t begin, uint64_t end, uint32_t crc );
+
+            PartJournal( const PartJournal& );
+            PartJournal& operator=( const PartJournal& );
+    };
+
+}
+
+#endif
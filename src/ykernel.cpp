@@ -0,0 +1,994 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "ycrc32.h"
+#include "ydispatch.h"
+#include "ykernel.h"
+
+namespace ykernel{
+
+    namespace{
+
+        const unsigned char escaped = 64;
+        const unsigned char magic = 42;
+
+        /**
+         * Shuffle masks for packing the bytes selected by an 8 bit mask to the front of an
+         * 8 byte lane, indexed by the mask. Unused positions are set to 0x80 so pshufb zeroes them.
+         */
+        struct CompactTable{
+            uint64_t shuffle[256];
+
+            CompactTable()
+            {
+                for( int mask = 0; mask < 256; mask++ ){
+                    unsigned char entry[8];
+                    int n = 0;
+
+                    memset( entry, 0x80, sizeof( entry ) );
+
+                    for( int bit = 0; bit < 8; bit++ ){
+
+                        if( mask & ( 1 << bit ) )
+                            entry[n++] = bit;
+
+                    }
+
+                    memcpy( &shuffle[mask], entry, sizeof( entry ) );
+                }
+            }
+        };
+
+        const CompactTable compact_table;
+
+        /**
+         * Pack the bytes of @p v selected by @p keep into @p dst. Only 8 bytes are ever stored at a time,
+         * so the stores never run past the end of the 16 byte block they came from; this keeps the kernels
+         * safe for in place decoding.
+         */
+        __attribute__(( target( "ssse3" ) ))
+        inline unsigned char* compact16( __m128i v, unsigned int keep, unsigned char *dst )
+        {
+            __m128i lo = _mm_shuffle_epi8( v, _mm_loadl_epi64( reinterpret_cast<const __m128i*>( &compact_table.shuffle[keep & 0xff] ) ) );
+            _mm_storel_epi64( reinterpret_cast<__m128i*>( dst ), lo );
+            dst += __builtin_popcount( keep & 0xff );
+
+            __m128i hi = _mm_shuffle_epi8( _mm_srli_si128( v, 8 ), _mm_loadl_epi64( reinterpret_cast<const __m128i*>( &compact_table.shuffle[( keep >> 8 ) & 0xff] ) ) );
+            _mm_storel_epi64( reinterpret_cast<__m128i*>( dst ), hi );
+            dst += __builtin_popcount( ( keep >> 8 ) & 0xff );
+
+            return dst;
+        }
+
+        /**
+         * @return \b true if @p c is one of the line ending characters removed for @p Style.
+         */
+        template<LineEnding::Style Style>
+        inline bool isLineEnding( unsigned char c )
+        {
+            return Style == LineEnding::CRLF ? c == '\r' || c == '\n' : Style == LineEnding::LF && c == '\n';
+        }
+
+        /**
+         * The scalar kernel for the line endings of @p Style. decodeScalar() is the CRLF version.
+         */
+        template<LineEnding::Style Style>
+        size_t decodeLines( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+        {
+            unsigned char *out = dst;
+
+            for( const unsigned char *end = src + len; src < end; src++ ){
+
+                if( escape ){
+                    *out++ = *src - escaped - magic;
+                    escape = false;
+                    continue;
+                }
+
+                if( isLineEnding<Style>( *src ) )
+                    continue;
+
+                if( *src == '=' ){
+                    escape = true;
+                    continue;
+                }
+
+                *out++ = *src - magic;
+            }
+
+            return out - dst;
+        }
+
+        /**
+         * @return A bit for each byte of @p v that is one of the line ending characters removed for @p Style. Without line
+         * endings this is a constant, so the kernels lose the compares altogether.
+         */
+        template<LineEnding::Style Style>
+        __attribute__(( target( "sse2" ) ))
+        inline unsigned int lineBits( __m128i v )
+        {
+            if( Style == LineEnding::NONE )
+                return 0;
+
+            __m128i found = _mm_cmpeq_epi8( v, _mm_set1_epi8( '\n' ) );
+
+            if( Style == LineEnding::CRLF )
+                found = _mm_or_si128( found, _mm_cmpeq_epi8( v, _mm_set1_epi8( '\r' ) ) );
+
+            return _mm_movemask_epi8( found );
+        }
+
+        template<LineEnding::Style Style>
+        __attribute__(( target( "avx2" ) ))
+        inline uint32_t lineBits( __m256i v )
+        {
+            if( Style == LineEnding::NONE )
+                return 0;
+
+            __m256i found = _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\n' ) );
+
+            if( Style == LineEnding::CRLF )
+                found = _mm256_or_si256( found, _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\r' ) ) );
+
+            return _mm256_movemask_epi8( found );
+        }
+
+        template<LineEnding::Style Style>
+        __attribute__(( target( "avx512f,avx512bw" ) ))
+        inline uint64_t lineBits( __m512i v )
+        {
+            if( Style == LineEnding::NONE )
+                return 0;
+
+            uint64_t found = _mm512_cmpeq_epi8_mask( v, _mm512_set1_epi8( '\n' ) );
+
+            if( Style == LineEnding::CRLF )
+                found |= _mm512_cmpeq_epi8_mask( v, _mm512_set1_epi8( '\r' ) );
+
+            return found;
+        }
+
+        template<LineEnding::Style Style>
+        __attribute__(( target( "sse2" ) ))
+        size_t decodeSSE2( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+        {
+            const __m128i eq = _mm_set1_epi8( '=' );
+            const __m128i offset = _mm_set1_epi8( magic );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            for( ; i + 16 <= len; i += 16 ){
+                __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+
+                if( !escape && !( _mm_movemask_epi8( _mm_cmpeq_epi8( v, eq ) ) | lineBits<Style>( v ) ) ){
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_sub_epi8( v, offset ) );
+                    out += 16;
+                }else{
+                    out += decodeLines<Style>( src + i, 16, out, escape );
+                }
+            }
+
+            return ( out - dst ) + decodeLines<Style>( src + i, len - i, out, escape );
+        }
+
+        template<LineEnding::Style Style>
+        __attribute__(( target( "ssse3" ) ))
+        size_t decodeSSSE3( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+        {
+            const __m128i eq = _mm_set1_epi8( '=' );
+            const __m128i offset = _mm_set1_epi8( magic );
+            const __m128i escape_offset = _mm_set1_epi8( escaped );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            for( ; i + 16 <= len; i += 16 ){
+                __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+                __m128i eq_v = _mm_cmpeq_epi8( v, eq );
+                unsigned int eq_bits = _mm_movemask_epi8( eq_v );
+                unsigned int eol_bits = lineBits<Style>( v );
+                unsigned int carry = escape ? 1 : 0;
+
+                if( !( eq_bits | eol_bits | carry ) ){
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_sub_epi8( v, offset ) );
+                    out += 16;
+                    continue;
+                }
+
+                unsigned int esc_bits = ( ( eq_bits << 1 ) | carry ) & 0xffff;
+
+                //An escaped '=' can only come from a broken encoder, leave runs of them to the scalar code
+                if( eq_bits & esc_bits ){
+                    out += decodeLines<Style>( src + i, 16, out, escape );
+                    continue;
+                }
+
+                __m128i esc_v = _mm_or_si128( _mm_slli_si128( eq_v, 1 ), _mm_cvtsi32_si128( carry ? 0xff : 0 ) );
+                v = _mm_sub_epi8( _mm_sub_epi8( v, offset ), _mm_and_si128( esc_v, escape_offset ) );
+                unsigned int remove = eq_bits | ( eol_bits & ~esc_bits );
+                out = compact16( v, ~remove & 0xffff, out );
+                escape = ( eq_bits >> 15 ) != 0;
+            }
+
+            return ( out - dst ) + decodeLines<Style>( src + i, len - i, out, escape );
+        }
+
+        template<LineEnding::Style Style>
+        __attribute__(( target( "avx2" ) ))
+        size_t decodeAVX2( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+        {
+            const __m256i eq = _mm256_set1_epi8( '=' );
+            const __m256i offset = _mm256_set1_epi8( magic );
+            const __m256i escape_offset = _mm256_set1_epi8( escaped );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            for( ; i + 32 <= len; i += 32 ){
+                __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + i ) );
+                __m256i eq_v = _mm256_cmpeq_epi8( v, eq );
+                uint32_t eq_bits = _mm256_movemask_epi8( eq_v );
+                uint32_t eol_bits = lineBits<Style>( v );
+                uint32_t carry = escape ? 1 : 0;
+
+                if( !( eq_bits | eol_bits | carry ) ){
+                    _mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), _mm256_sub_epi8( v, offset ) );
+                    out += 32;
+                    continue;
+                }
+
+                uint32_t esc_bits = ( eq_bits << 1 ) | carry;
+
+                if( eq_bits & esc_bits ){
+                    out += decodeLines<Style>( src + i, 32, out, escape );
+                    continue;
+                }
+
+                //Shift the escape character mask up one byte, across the lanes, and feed in the carry
+                __m256i esc_v = _mm256_alignr_epi8( eq_v, _mm256_permute2x128_si256( eq_v, eq_v, 0x08 ), 15 );
+                esc_v = _mm256_or_si256( esc_v, _mm256_setr_epi32( carry ? 0xff : 0, 0, 0, 0, 0, 0, 0, 0 ) );
+                v = _mm256_sub_epi8( _mm256_sub_epi8( v, offset ), _mm256_and_si256( esc_v, escape_offset ) );
+                uint32_t keep = ~( eq_bits | ( eol_bits & ~esc_bits ) );
+                out = compact16( _mm256_castsi256_si128( v ), keep & 0xffff, out );
+                out = compact16( _mm256_extracti128_si256( v, 1 ), keep >> 16, out );
+                escape = ( eq_bits >> 31 ) != 0;
+            }
+
+            return ( out - dst ) + decodeSSSE3<Style>( src + i, len - i, out, escape );
+        }
+
+        /**
+         * Like decodeAVX2(), 64 bytes at a time. The special characters are found with mask compares, and the escaped
+         * bytes are adjusted with a masked subtract, which leaves only the packing to the 16 byte code.
+         */
+        template<LineEnding::Style Style>
+        __attribute__(( target( "avx512f,avx512bw" ) ))
+        size_t decodeAVX512( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+        {
+            const __m512i eq = _mm512_set1_epi8( '=' );
+            const __m512i offset = _mm512_set1_epi8( magic );
+            const __m512i escape_offset = _mm512_set1_epi8( escaped );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            for( ; i + 64 <= len; i += 64 ){
+                __m512i v = _mm512_loadu_si512( src + i );
+                uint64_t eq_bits = _mm512_cmpeq_epi8_mask( v, eq );
+                uint64_t eol_bits = lineBits<Style>( v );
+                uint64_t carry = escape ? 1 : 0;
+
+                if( !( eq_bits | eol_bits | carry ) ){
+                    _mm512_storeu_si512( out, _mm512_sub_epi8( v, offset ) );
+                    out += 64;
+                    continue;
+                }
+
+                uint64_t esc_bits = ( eq_bits << 1 ) | carry;
+
+                if( eq_bits & esc_bits ){
+                    out += decodeLines<Style>( src + i, 64, out, escape );
+                    continue;
+                }
+
+                v = _mm512_sub_epi8( v, offset );
+                v = _mm512_mask_sub_epi8( v, esc_bits, v, escape_offset );
+                uint64_t keep = ~( eq_bits | ( eol_bits & ~esc_bits ) );
+                __m256i lo = _mm512_castsi512_si256( v );
+                __m256i hi = _mm512_extracti64x4_epi64( v, 1 );
+                out = compact16( _mm256_castsi256_si128( lo ), keep & 0xffff, out );
+                out = compact16( _mm256_extracti128_si256( lo, 1 ), ( keep >> 16 ) & 0xffff, out );
+                out = compact16( _mm256_castsi256_si128( hi ), ( keep >> 32 ) & 0xffff, out );
+                out = compact16( _mm256_extracti128_si256( hi, 1 ), keep >> 48, out );
+                escape = ( eq_bits >> 63 ) != 0;
+            }
+
+            return ( out - dst ) + decodeAVX2<Style>( src + i, len - i, out, escape );
+        }
+
+        /**
+         * Like decodeSSE2(), for data straight from an NNTP response. Blocks holding any special character, including
+         * the linefeeds that dots could follow, are left to the scalar code.
+         */
+        __attribute__(( target( "sse2" ) ))
+        size_t decodeNntpSSE2( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed )
+        {
+            const __m128i eq = _mm_set1_epi8( '=' );
+            const __m128i cr = _mm_set1_epi8( '\r' );
+            const __m128i lf = _mm_set1_epi8( '\n' );
+            const __m128i offset = _mm_set1_epi8( magic );
+            unsigned char *out = dst;
+            size_t i = 0;
+            size_t used;
+
+            for( ; i + 16 <= len; i += 16 ){
+                __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+                __m128i special = _mm_or_si128( _mm_cmpeq_epi8( v, eq ), _mm_or_si128( _mm_cmpeq_epi8( v, cr ), _mm_cmpeq_epi8( v, lf ) ) );
+
+                if( !state.escape && !state.line && !_mm_movemask_epi8( special ) ){
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_sub_epi8( v, offset ) );
+                    out += 16;
+                    continue;
+                }
+
+                out += decodeNntpScalar( src + i, 16, out, state, used );
+
+                if( state.end ){
+                    consumed = i + used;
+                    return out - dst;
+                }
+            }
+
+            out += decodeNntpScalar( src + i, len - i, out, state, used );
+            consumed = i + used;
+            return out - dst;
+        }
+
+        /**
+         * Like decodeSSSE3(), for data straight from an NNTP response. The dots stuffed at the start of lines are
+         * removed along with the escape characters and line endings. Blocks holding a line that may end the data,
+         * or ending on a dot or an '=' at the start of a line, are left to the scalar code, as are blocks starting
+         * just after one.
+         */
+        __attribute__(( target( "ssse3" ) ))
+        size_t decodeNntpSSSE3( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed )
+        {
+            const __m128i eq = _mm_set1_epi8( '=' );
+            const __m128i cr = _mm_set1_epi8( '\r' );
+            const __m128i lf = _mm_set1_epi8( '\n' );
+            const __m128i dot = _mm_set1_epi8( '.' );
+            const __m128i y = _mm_set1_epi8( 'y' );
+            const __m128i offset = _mm_set1_epi8( magic );
+            const __m128i escape_offset = _mm_set1_epi8( escaped );
+            unsigned char *out = dst;
+            size_t i = 0;
+            size_t used;
+
+            for( ; i + 16 <= len; i += 16 ){
+                __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+                __m128i eq_v = _mm_cmpeq_epi8( v, eq );
+                unsigned int eq_bits = _mm_movemask_epi8( eq_v );
+                unsigned int cr_bits = _mm_movemask_epi8( _mm_cmpeq_epi8( v, cr ) );
+                unsigned int lf_bits = _mm_movemask_epi8( _mm_cmpeq_epi8( v, lf ) );
+                unsigned int carry = state.escape ? 1 : 0;
+
+                if( !( eq_bits | cr_bits | lf_bits | carry | state.line ) ){
+                    _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_sub_epi8( v, offset ) );
+                    out += 16;
+                    continue;
+                }
+
+                unsigned int esc_bits = ( ( eq_bits << 1 ) | carry ) & 0xffff;
+                unsigned int line_bits = ( ( ( lf_bits & ~esc_bits ) << 1 ) | ( state.line == NntpState::LINE_START ? 1 : 0 ) ) & 0xffff;
+                unsigned int stuffed = line_bits & _mm_movemask_epi8( _mm_cmpeq_epi8( v, dot ) );
+                unsigned int leading_eq = line_bits & eq_bits;
+
+                if( ( eq_bits & esc_bits ) || state.line > NntpState::LINE_START || ( ( stuffed | leading_eq ) & 0x8000 ) ||
+                    ( ( stuffed << 1 ) & ( cr_bits | lf_bits ) ) || ( ( leading_eq << 1 ) & _mm_movemask_epi8( _mm_cmpeq_epi8( v, y ) ) ) ){
+                    out += decodeNntpScalar( src + i, 16, out, state, used );
+
+                    if( state.end ){
+                        consumed = i + used;
+                        return out - dst;
+                    }
+
+                    continue;
+                }
+
+                __m128i esc_v = _mm_or_si128( _mm_slli_si128( eq_v, 1 ), _mm_cvtsi32_si128( carry ? 0xff : 0 ) );
+                v = _mm_sub_epi8( _mm_sub_epi8( v, offset ), _mm_and_si128( esc_v, escape_offset ) );
+                unsigned int remove = eq_bits | ( ( cr_bits | lf_bits ) & ~esc_bits ) | stuffed;
+                out = compact16( v, ~remove & 0xffff, out );
+                state.escape = ( eq_bits >> 15 ) != 0;
+                state.line = ( ( lf_bits & ~esc_bits ) >> 15 ) ? NntpState::LINE_START : NntpState::MIDDLE;
+            }
+
+            out += decodeNntpScalar( src + i, len - i, out, state, used );
+            consumed = i + used;
+            return out - dst;
+        }
+
+        /**
+         * Like decodeNntpSSSE3(), 32 bytes at a time.
+         */
+        __attribute__(( target( "avx2" ) ))
+        size_t decodeNntpAVX2( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed )
+        {
+            const __m256i eq = _mm256_set1_epi8( '=' );
+            const __m256i cr = _mm256_set1_epi8( '\r' );
+            const __m256i lf = _mm256_set1_epi8( '\n' );
+            const __m256i dot = _mm256_set1_epi8( '.' );
+            const __m256i y = _mm256_set1_epi8( 'y' );
+            const __m256i offset = _mm256_set1_epi8( magic );
+            const __m256i escape_offset = _mm256_set1_epi8( escaped );
+            unsigned char *out = dst;
+            size_t i = 0;
+            size_t used;
+
+            for( ; i + 32 <= len; i += 32 ){
+                __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + i ) );
+                __m256i eq_v = _mm256_cmpeq_epi8( v, eq );
+                uint32_t eq_bits = _mm256_movemask_epi8( eq_v );
+                uint32_t cr_bits = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, cr ) );
+                uint32_t lf_bits = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, lf ) );
+                uint32_t carry = state.escape ? 1 : 0;
+
+                if( !( eq_bits | cr_bits | lf_bits | carry | state.line ) ){
+                    _mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), _mm256_sub_epi8( v, offset ) );
+                    out += 32;
+                    continue;
+                }
+
+                uint32_t esc_bits = ( eq_bits << 1 ) | carry;
+                uint32_t line_bits = ( ( lf_bits & ~esc_bits ) << 1 ) | ( state.line == NntpState::LINE_START ? 1 : 0 );
+                uint32_t stuffed = line_bits & _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, dot ) );
+                uint32_t leading_eq = line_bits & eq_bits;
+
+                if( ( eq_bits & esc_bits ) || state.line > NntpState::LINE_START || ( ( stuffed | leading_eq ) >> 31 ) ||
+                    ( ( stuffed << 1 ) & ( cr_bits | lf_bits ) ) || ( ( leading_eq << 1 ) & _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, y ) ) ) ){
+                    out += decodeNntpScalar( src + i, 32, out, state, used );
+
+                    if( state.end ){
+                        consumed = i + used;
+                        return out - dst;
+                    }
+
+                    continue;
+                }
+
+                __m256i esc_v = _mm256_alignr_epi8( eq_v, _mm256_permute2x128_si256( eq_v, eq_v, 0x08 ), 15 );
+                esc_v = _mm256_or_si256( esc_v, _mm256_setr_epi32( carry ? 0xff : 0, 0, 0, 0, 0, 0, 0, 0 ) );
+                v = _mm256_sub_epi8( _mm256_sub_epi8( v, offset ), _mm256_and_si256( esc_v, escape_offset ) );
+                uint32_t keep = ~( eq_bits | ( ( cr_bits | lf_bits ) & ~esc_bits ) | stuffed );
+                out = compact16( _mm256_castsi256_si128( v ), keep & 0xffff, out );
+                out = compact16( _mm256_extracti128_si256( v, 1 ), keep >> 16, out );
+                state.escape = ( eq_bits >> 31 ) != 0;
+                state.line = ( ( lf_bits & ~esc_bits ) >> 31 ) ? NntpState::LINE_START : NntpState::MIDDLE;
+            }
+
+            out += decodeNntpSSSE3( src + i, len - i, out, state, used );
+            consumed = i + used;
+            return out - dst;
+        }
+
+        typedef size_t ( *DecodeFunction )( const unsigned char*, size_t, unsigned char*, bool& );
+
+        /**
+         * The versions of the decode kernel for the line endings of @p Style.
+         */
+        template<LineEnding::Style Style>
+        struct DecodeKernels{
+            static const ydispatch::Kernel<DecodeFunction> table[5];
+        };
+
+        template<LineEnding::Style Style>
+        const ydispatch::Kernel<DecodeFunction> DecodeKernels<Style>::table[5] = {
+            { ydispatch::CpuLevel::AVX512, "avx512", decodeAVX512<Style> },
+            { ydispatch::CpuLevel::AVX2, "avx2", decodeAVX2<Style> },
+            { ydispatch::CpuLevel::SSSE3, "ssse3", decodeSSSE3<Style> },
+            { ydispatch::CpuLevel::SSE2, "sse2", decodeSSE2<Style> },
+            { ydispatch::CpuLevel::SCALAR, "scalar", decodeLines<Style> }
+        };
+
+        /**
+         * The decode kernel in use for each line ending style.
+         */
+        const ydispatch::Kernel<DecodeFunction> *decode_kernel[] = {
+            &DecodeKernels<LineEnding::CRLF>::table[4],
+            &DecodeKernels<LineEnding::LF>::table[4],
+            &DecodeKernels<LineEnding::NONE>::table[4]
+        };
+
+        /**
+         * Decode a span with the kernel in use for @p Style, and add the decoded data to @p crc if @p Crc is set. The span is
+         * decoded in blocks small enough to stay in the L1 cache, and each block is added to the crc32 straight after it is
+         * decoded, so the decoded data is only brought into the cache once.
+         */
+        template<LineEnding::Style Style, bool Crc>
+        size_t decodeSpan( const unsigned char *src, size_t len, unsigned char *dst, bool &escape, uint32_t &crc )
+        {
+            const DecodeFunction decode_function = decode_kernel[Style]->function;
+
+            if( !Crc )
+                return decode_function( src, len, dst, escape );
+
+            //Small enough to leave room in L1 for the encoded input and the crc tables
+            const size_t block = 4096;
+            size_t length = 0;
+
+            while( len ){
+                size_t chunk = len < block ? len : block;
+                size_t produced = decode_function( src, chunk, dst + length, escape );
+                crc = ycrc32::crc32( crc, dst + length, produced );
+                length += produced;
+                src += chunk;
+                len -= chunk;
+            }
+
+            return length;
+        }
+
+        const SpanDecoder span_decoders[][2] = {
+            { decodeSpan<LineEnding::CRLF, false>, decodeSpan<LineEnding::CRLF, true> },
+            { decodeSpan<LineEnding::LF, false>, decodeSpan<LineEnding::LF, true> },
+            { decodeSpan<LineEnding::NONE, false>, decodeSpan<LineEnding::NONE, true> }
+        };
+
+        typedef size_t ( *NntpFunction )( const unsigned char*, size_t, unsigned char*, NntpState&, size_t& );
+
+        const ydispatch::Kernel<NntpFunction> nntp_kernels[] = {
+            { ydispatch::CpuLevel::AVX2, "avx2", decodeNntpAVX2 },
+            { ydispatch::CpuLevel::SSSE3, "ssse3", decodeNntpSSSE3 },
+            { ydispatch::CpuLevel::SSE2, "sse2", decodeNntpSSE2 },
+            { ydispatch::CpuLevel::SCALAR, "scalar", decodeNntpScalar }
+        };
+
+        const ydispatch::Kernel<NntpFunction> *nntp_kernel = &nntp_kernels[3];
+
+        /**
+         * Shuffle and offset vectors for expanding an 8 byte lane of encoded characters, indexed by the mask of the
+         * characters that need escaping. Each escaped character is duplicated; the shuffle zeroes the first copy and
+         * the offset turns it into the escape character, and adds the escape offset to the second copy.
+         */
+        struct ExpandTable{
+            unsigned char shuffle[256][16];
+            unsigned char offset[256][16];
+
+            ExpandTable()
+            {
+                for( int mask = 0; mask < 256; mask++ ){
+                    int n = 0;
+
+                    memset( shuffle[mask], 0x80, sizeof( shuffle[mask] ) );
+                    memset( offset[mask], 0, sizeof( offset[mask] ) );
+
+                    for( int bit = 0; bit < 8; bit++ ){
+
+                        if( mask & ( 1 << bit ) )
+                            offset[mask][n++] = '=';
+
+                        shuffle[mask][n] = bit;
+                        offset[mask][n++] = mask & ( 1 << bit ) ? escaped : 0;
+                    }
+                }
+            }
+        };
+
+        const ExpandTable expand_table;
+
+        /**
+         * Classifies encoded characters by when they need escaping, so the common case costs a single lookup.
+         */
+        struct EscapeTable{
+            enum Class{
+                NEVER = 0,
+                ALWAYS = 1,
+                LINE_EDGE = 2, /**< At the start or end of a line */
+                LINE_START = 4
+            };
+
+            unsigned char type[256];
+
+            EscapeTable()
+            {
+                memset( type, NEVER, sizeof( type ) );
+                type[0] = type['\n'] = type['\r'] = type['='] = ALWAYS;
+                type['\t'] = type[' '] = LINE_EDGE;
+                type['.'] = LINE_START;
+            }
+        };
+
+        const EscapeTable escape_table;
+
+        /**
+         * Encode a single byte, starting a new line first if the current one is full.
+         */
+        inline unsigned char* encodeByte( unsigned char c, unsigned char *out, unsigned int line_length, unsigned int &column, bool final )
+        {
+            if( column >= line_length ){
+                *out++ = '\r';
+                *out++ = '\n';
+                column = 0;
+            }
+
+            c += magic;
+            unsigned char type = escape_table.type[c];
+
+            if( type && ( type == EscapeTable::ALWAYS || column == 0 ||
+                          ( type == EscapeTable::LINE_EDGE && ( column == line_length - 1 || final ) ) ) ){
+                *out++ = '=';
+                *out++ = c + escaped;
+                column += 2;
+            }else{
+                *out++ = c;
+                column++;
+            }
+
+            return out;
+        }
+
+        /**
+         * Write the low 8 bytes of @p v, escaping the bytes selected by @p mask. Always stores 16 bytes.
+         */
+        __attribute__(( target( "ssse3" ) ))
+        inline unsigned char* expand8( __m128i v, unsigned int mask, unsigned char *dst )
+        {
+            __m128i out = _mm_shuffle_epi8( v, _mm_loadu_si128( reinterpret_cast<const __m128i*>( expand_table.shuffle[mask] ) ) );
+            out = _mm_add_epi8( out, _mm_loadu_si128( reinterpret_cast<const __m128i*>( expand_table.offset[mask] ) ) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( dst ), out );
+            return dst + 8 + __builtin_popcount( mask );
+        }
+
+        __attribute__(( target( "sse2" ) ))
+        inline __m128i criticalMask( __m128i v )
+        {
+            __m128i crit = _mm_or_si128( _mm_cmpeq_epi8( v, _mm_setzero_si128() ), _mm_cmpeq_epi8( v, _mm_set1_epi8( '=' ) ) );
+            return _mm_or_si128( crit, _mm_or_si128( _mm_cmpeq_epi8( v, _mm_set1_epi8( '\r' ) ), _mm_cmpeq_epi8( v, _mm_set1_epi8( '\n' ) ) ) );
+        }
+
+        /*
+         * The vectorized encoders only handle blocks whose output lands strictly inside a line, ie. not in the first
+         * or last column, where tabs, spaces and dots need escaping and line endings have to be inserted. Everything
+         * else, including the last byte of the data, goes through encodeByte().
+         */
+
+        __attribute__(( target( "sse2" ) ))
+        size_t encodeSSE2( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last )
+        {
+            const __m128i offset = _mm_set1_epi8( magic );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            while( i + 16 < len ){
+
+                if( column > 0 && column + 16 < line_length ){
+                    __m128i v = _mm_add_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) ), offset );
+
+                    if( !_mm_movemask_epi8( criticalMask( v ) ) ){
+                        _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), v );
+                        out += 16;
+                        column += 16;
+                        i += 16;
+                        continue;
+                    }
+
+                }
+
+                out = encodeByte( src[i++], out, line_length, column, false );
+            }
+
+            return ( out - dst ) + encodeScalar( src + i, len - i, out, line_length, column, last );
+        }
+
+        __attribute__(( target( "ssse3" ) ))
+        inline bool encodeBlock16( const unsigned char *src, unsigned char *&out, unsigned int line_length, unsigned int &column )
+        {
+            __m128i v = _mm_add_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( src ) ), _mm_set1_epi8( magic ) );
+            unsigned int mask = _mm_movemask_epi8( criticalMask( v ) );
+            unsigned int n = 16 + __builtin_popcount( mask );
+
+            if( column + n >= line_length )
+                return false;
+
+            if( mask ){
+                out = expand8( v, mask & 0xff, out );
+                out = expand8( _mm_srli_si128( v, 8 ), mask >> 8, out );
+            }else{
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), v );
+                out += 16;
+            }
+
+            column += n;
+            return true;
+        }
+
+        /**
+         * Used towards the end of a line, where a 16 byte block may not fit anymore.
+         */
+        __attribute__(( target( "ssse3" ) ))
+        inline bool encodeBlock8( const unsigned char *src, unsigned char *&out, unsigned int line_length, unsigned int &column )
+        {
+            __m128i v = _mm_add_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( src ) ), _mm_set1_epi8( magic ) );
+            unsigned int mask = _mm_movemask_epi8( criticalMask( v ) ) & 0xff;
+            unsigned int n = 8 + __builtin_popcount( mask );
+
+            if( column + n >= line_length )
+                return false;
+
+            out = expand8( v, mask, out );
+            column += n;
+            return true;
+        }
+
+        __attribute__(( target( "ssse3" ) ))
+        size_t encodeSSSE3( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last )
+        {
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            while( i + 16 < len ){
+
+                if( column > 0 && encodeBlock16( src + i, out, line_length, column ) ){
+                    i += 16;
+                    continue;
+                }
+
+                if( column > 0 && encodeBlock8( src + i, out, line_length, column ) ){
+                    i += 8;
+                    continue;
+                }
+
+                //Nothing fits anymore, so finish the line a byte at a time, up to the first byte of the next one
+                bool wrapped;
+
+                do{
+                    wrapped = column == 0 || column >= line_length;
+                    out = encodeByte( src[i++], out, line_length, column, false );
+                }while( !wrapped && i + 16 < len );
+            }
+
+            return ( out - dst ) + encodeScalar( src + i, len - i, out, line_length, column, last );
+        }
+
+        __attribute__(( target( "avx2" ) ))
+        size_t encodeAVX2( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last )
+        {
+            const __m256i offset = _mm256_set1_epi8( magic );
+            unsigned char *out = dst;
+            size_t i = 0;
+
+            while( i + 32 < len ){
+
+                if( column > 0 ){
+                    __m256i v = _mm256_add_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + i ) ), offset );
+                    __m256i crit = _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_setzero_si256() ), _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '=' ) ) );
+                    crit = _mm256_or_si256( crit, _mm256_or_si256( _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\r' ) ), _mm256_cmpeq_epi8( v, _mm256_set1_epi8( '\n' ) ) ) );
+                    uint32_t mask = _mm256_movemask_epi8( crit );
+                    unsigned int n = 32 + __builtin_popcount( mask );
+
+                    if( column + n < line_length ){
+
+                        if( mask ){
+                            __m128i lo = _mm256_castsi256_si128( v );
+                            __m128i hi = _mm256_extracti128_si256( v, 1 );
+                            out = expand8( lo, mask & 0xff, out );
+                            out = expand8( _mm_srli_si128( lo, 8 ), ( mask >> 8 ) & 0xff, out );
+                            out = expand8( hi, ( mask >> 16 ) & 0xff, out );
+                            out = expand8( _mm_srli_si128( hi, 8 ), mask >> 24, out );
+                        }else{
+                            _mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), v );
+                            out += 32;
+                        }
+
+                        column += n;
+                        i += 32;
+                        continue;
+                    }
+
+                    //Towards the end of a line a smaller block may still fit
+                    if( encodeBlock16( src + i, out, line_length, column ) ){
+                        i += 16;
+                        continue;
+                    }
+
+                    if( encodeBlock8( src + i, out, line_length, column ) ){
+                        i += 8;
+                        continue;
+                    }
+
+                }
+
+                //Nothing fits anymore, so finish the line a byte at a time, up to the first byte of the next one
+                bool wrapped;
+
+                do{
+                    wrapped = column == 0 || column >= line_length;
+                    out = encodeByte( src[i++], out, line_length, column, false );
+                }while( !wrapped && i + 32 < len );
+            }
+
+            return ( out - dst ) + encodeSSSE3( src + i, len - i, out, line_length, column, last );
+        }
+
+        typedef size_t ( *EncodeFunction )( const unsigned char*, size_t, unsigned char*, unsigned int, unsigned int&, bool );
+
+        const ydispatch::Kernel<EncodeFunction> encode_kernels[] = {
+            { ydispatch::CpuLevel::AVX2, "avx2", encodeAVX2 },
+            { ydispatch::CpuLevel::SSSE3, "ssse3", encodeSSSE3 },
+            { ydispatch::CpuLevel::SSE2, "sse2", encodeSSE2 },
+            { ydispatch::CpuLevel::SCALAR, "scalar", encodeScalar }
+        };
+
+        const ydispatch::Kernel<EncodeFunction> *encode_kernel = &encode_kernels[3];
+
+        /**
+         * Picks the kernels when the library is loaded. Until then the scalar kernels are used.
+         */
+        struct Selector{
+            Selector(){ select(); }
+        };
+
+        const Selector selector;
+    }
+
+    void select()
+    {
+        decode_kernel[LineEnding::CRLF] = ydispatch::choose( DecodeKernels<LineEnding::CRLF>::table );
+        decode_kernel[LineEnding::LF] = ydispatch::choose( DecodeKernels<LineEnding::LF>::table );
+        decode_kernel[LineEnding::NONE] = ydispatch::choose( DecodeKernels<LineEnding::NONE>::table );
+        nntp_kernel = ydispatch::choose( nntp_kernels );
+        encode_kernel = ydispatch::choose( encode_kernels );
+    }
+
+    const char* decodeKernel()
+    {
+        return decode_kernel[LineEnding::CRLF]->name;
+    }
+
+    const char* encodeKernel()
+    {
+        return encode_kernel->name;
+    }
+
+    size_t decodeScalar( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+    {
+        return decodeLines<LineEnding::CRLF>( src, len, dst, escape );
+    }
+
+    size_t decode( const unsigned char *src, size_t len, unsigned char *dst, bool &escape )
+    {
+        return decode_kernel[LineEnding::CRLF]->function( src, len, dst, escape );
+    }
+
+    size_t decodeCrc( const unsigned char *src, size_t len, unsigned char *dst, bool &escape, uint32_t &crc )
+    {
+        return decodeSpan<LineEnding::CRLF, true>( src, len, dst, escape, crc );
+    }
+
+    SpanDecoder decoder( LineEnding::Style style, bool crc )
+    {
+        return span_decoders[style][crc ? 1 : 0];
+    }
+
+    size_t decodeNntpScalar( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed )
+    {
+        unsigned char *out = dst;
+        size_t i = 0;
+
+        for( ; i < len && !state.end; i++ ){
+            unsigned char c = src[i];
+            NntpState::Line line = state.line;
+            state.line = NntpState::MIDDLE;
+
+            if( line == NntpState::LINE_START ){
+
+                //A dot at the start of a line is either stuffing or the start of the terminating line
+                if( c == '.' ){
+                    state.line = NntpState::DOT;
+                    continue;
+                }
+
+                if( c == '=' )
+                    state.line = NntpState::EQUALS;
+
+            }else if( line == NntpState::DOT && ( c == '\r' || c == '\n' ) ){
+                state.end = NntpState::TERMINATOR;
+                continue;
+            }else if( line == NntpState::EQUALS && c == 'y' ){
+                state.escape = false;
+                state.end = NntpState::TRAILER;
+                continue;
+            }
+
+            if( state.escape ){
+                *out++ = c - escaped - magic;
+                state.escape = false;
+                continue;
+            }
+
+            if( c == '\n' ){
+                state.line = NntpState::LINE_START;
+                continue;
+            }
+
+            if( c == '\r' )
+                continue;
+
+            if( c == '=' ){
+                state.escape = true;
+                continue;
+            }
+
+            *out++ = c - magic;
+        }
+
+        consumed = i;
+        return out - dst;
+    }
+
+    size_t decodeNntp( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed )
+    {
+        if( state.end ){
+            consumed = 0;
+            return 0;
+        }
+
+        return nntp_kernel->function( src, len, dst, state, consumed );
+    }
+
+    size_t decodeNntpCrc( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed, uint32_t &crc )
+    {
+        const size_t block = 4096;
+        const NntpFunction nntp_function = nntp_kernel->function;
+        size_t length = 0;
+
+        for( consumed = 0; consumed < len && !state.end; ){
+            size_t used;
+            size_t produced = nntp_function( src + consumed, len - consumed < block ? len - consumed : block, dst + length, state, used );
+            crc = ycrc32::crc32( crc, dst + length, produced );
+            length += produced;
+            consumed += used;
+        }
+
+        return length;
+    }
+
+    size_t encodeScalar( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last )
+    {
+        unsigned char *out = dst;
+
+        for( size_t i = 0; i < len; i++ )
+            out = encodeByte( src[i], out, line_length, column, last && i + 1 == len );
+
+        return out - dst;
+    }
+
+    size_t encode( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last )
+    {
+        return encode_kernel->function( src, len, dst, line_length, column, last );
+    }
+
+    size_t encodedSizeBound( size_t len, unsigned int line_length )
+    {
+        //Every byte escaped, plus a line ending for every full line, plus room for a stray register store
+        return 2 * len + 2 * ( 2 * len / ( line_length ? line_length : 1 ) + 1 ) + 64;
+    }
+
+}
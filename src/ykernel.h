@@ -0,0 +1,204 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ykernel
+ * The namespace for the low level yenc coding kernels shared by the encoder and decoder.
+ */
+#ifndef YKERNEL_YKERNEL_H
+#define YKERNEL_YKERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ykernel{
+
+    /**
+     * Decode a span of yencoded body data. Carriage returns and linefeeds are stripped, escape
+     * characters are removed and the magic offset is subtracted from every remaining byte.
+     *
+     * The span does not need to start or end on a line boundary. If the span ends on an escape
+     * character then @p escape is set, and the first byte of the next span will be unescaped.
+     *
+     * @param src The encoded data.
+     *
+     * @param len The number of bytes in @p src.
+     *
+     * @param dst The buffer to write the decoded data to. It must have room for @p len bytes. It may
+     * be the same as @p src, in which case the data is decoded in place.
+     *
+     * @param escape Set to \b true if the previous span ended on an escape character. Updated on return.
+     *
+     * @return The number of bytes written to @p dst.
+     */
+    size_t decode( const unsigned char *src, size_t len, unsigned char *dst, bool &escape );
+
+    /**
+     * The reference implementation of decode(), processing a byte at a time. The vectorized kernels
+     * fall back to this for blocks they can't handle, so its output defines the output of all of them.
+     */
+    size_t decodeScalar( const unsigned char *src, size_t len, unsigned char *dst, bool &escape );
+
+    /**
+     * Decode a span like decode(), and add the decoded data to a crc32 on the way. The span is decoded in blocks
+     * small enough to stay in the L1 cache, and each block is added to the crc32 straight after it is decoded, so
+     * the decoded data is only brought into the cache once. As with decode(), @p dst may be the same as @p src.
+     *
+     * @param crc The crc32 of the data decoded so far, or 0 for new data, as for ycrc32::crc32(). Updated on return.
+     *
+     * @return The number of bytes written to @p dst.
+     */
+    size_t decodeCrc( const unsigned char *src, size_t len, unsigned char *dst, bool &escape, uint32_t &crc );
+
+    namespace LineEnding{
+            enum Style{
+                CRLF = 0, /**< Lines end on CRLF. Both CR and LF are removed wherever they are, so this suits any input */
+                LF, /**< Lines end on a bare LF. Only LFs are removed; encoders always escape a CR, so there are none to remove */
+                NONE /**< The line endings were removed beforehand, as when the data is read a line at a time */
+            };
+    }
+
+    /**
+     * A function decoding a span of body data like decode(), and adding the decoded data to a crc32 like decodeCrc()
+     * if it was asked for one.
+     */
+    typedef size_t ( *SpanDecoder )( const unsigned char *src, size_t len, unsigned char *dst, bool &escape, uint32_t &crc );
+
+    /**
+     * Pick the decoder for the data of an article. Each combination of line endings and crc32 is an instantiation of
+     * its own of the kernels, so the decode loops only look for the line endings the data has, and don't test for
+     * anything else. Call this once the header of an article has been read, and use the function returned for all
+     * of its data. decode() and decodeCrc() are the CRLF versions.
+     *
+     * @param style The line endings of the data.
+     *
+     * @param crc Set to \b true to have the crc32 of the data calculated as it is decoded, as by decodeCrc(). If this is
+     * \b false, the crc argument of the function returned is left alone.
+     */
+    SpanDecoder decoder( LineEnding::Style style, bool crc );
+
+    /**
+     * @struct NntpState ykernel.h
+     *
+     * @brief The state decodeNntp() carries from one span to the next.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct NntpState{
+        enum Line{
+            MIDDLE = 0, /**< In the middle of a line */
+            LINE_START, /**< At the start of a line */
+            DOT, /**< Just after the dot at the start of a line */
+            EQUALS /**< Just after the '=' at the start of a line */
+        };
+
+        enum End{
+            NONE = 0, /**< The end of the data hasn't been found yet */
+            TRAILER, /**< The data ended on a line starting with \c =y */
+            TERMINATOR /**< The data ended on a line holding a single dot */
+        };
+
+        NntpState() : escape( false ), line( LINE_START ), end( NONE ){}
+
+        bool escape; /**< The previous span ended on an escape character */
+        Line line; /**< Where in its line the previous span ended */
+        End end; /**< How the data ended, once it has */
+    };
+
+    /**
+     * Decode a span of yencoded body data straight from an NNTP response, like decode(). Besides decoding the data,
+     * the dot stuffing of the response is undone, so the dot at the start of a line starting with a dot is removed,
+     * and the end of the data is found in the same pass: decoding stops on the \c =yend line, which is the only line
+     * starting with \c =y that a valid body can hold, or on the line holding a single dot that terminates the response.
+     *
+     * @param state The state from the previous span. A default constructed state starts at the start of a line.
+     * Once the end of the data is found, \c state.end is set and nothing more is decoded.
+     *
+     * @param consumed Receives the number of bytes of @p src used. This is @p len unless the end of the data was found,
+     * in which case it stops just after the first 2 bytes of the line that ends the data: the \c =y, or the dot and the
+     * first character of its line ending.
+     *
+     * @return The number of bytes written to @p dst.
+     */
+    size_t decodeNntp( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed );
+
+    /**
+     * The reference implementation of decodeNntp(), processing a byte at a time.
+     */
+    size_t decodeNntpScalar( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed );
+
+    /**
+     * Decode a span like decodeNntp(), and add the decoded data to a crc32 on the way, like decodeCrc().
+     */
+    size_t decodeNntpCrc( const unsigned char *src, size_t len, unsigned char *dst, NntpState &state, size_t &consumed, uint32_t &crc );
+
+    /**
+     * Encode a span of data, wrapping the output into lines. NUL, LF, CR and '=' are always escaped, as are tabs and
+     * spaces at the start or end of a line and dots at the start of a line. The line ending is written before the first
+     * character of the next line rather than after the last character of a line, so the encoded data never ends on an
+     * empty line; the caller has to terminate the last line.
+     *
+     * @param src The data to encode.
+     *
+     * @param len The number of bytes in @p src.
+     *
+     * @param dst The buffer to write the encoded data to. It must have room for encodedSizeBound( @p len, @p line_length ) bytes.
+     *
+     * @param line_length The number of characters per line.
+     *
+     * @param column The column the first character will be written to. Updated on return, so that the data can be
+     * encoded in several spans.
+     *
+     * @param last Set to \b true if this is the last span of the data, so that a trailing space or tab is escaped.
+     *
+     * @return The number of bytes written to @p dst.
+     */
+    size_t encode( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last );
+
+    /**
+     * The reference implementation of encode(), processing a byte at a time.
+     */
+    size_t encodeScalar( const unsigned char *src, size_t len, unsigned char *dst, unsigned int line_length, unsigned int &column, bool last );
+
+    /**
+     * @return The most bytes encode() can write for @p len bytes of data, including the room the vectorized kernels need
+     * to store whole registers.
+     */
+    size_t encodedSizeBound( size_t len, unsigned int line_length );
+
+    /**
+     * Pick the fastest decode and encode kernels the level set in ydispatch allows. This happens when the library is
+     * loaded, and again whenever ydispatch::setLevel() is called.
+     */
+    void select();
+
+    /**
+     * @return The name of the decode kernel in use.
+     */
+    const char* decodeKernel();
+
+    /**
+     * @return The name of the encode kernel in use.
+     */
+    const char* encodeKernel();
+
+}
+
+#endif
@@ -0,0 +1,227 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include "yfile.h"
+#include "ykernel.h"
+#include "ypipeline.h"
+#include "ystats.h"
+
+namespace ypipeline{
+
+    namespace{
+
+        /**
+         * The number of blocks per decoder thread: one being decoded, one waiting for it and one on its way to the writer.
+         */
+        const unsigned int blocks_per_decoder = 3;
+
+        /**
+         * @return The number of blocks for @p decoders decoder threads, where 0 means one thread per processor.
+         */
+        size_t blockCount( unsigned int decoders )
+        {
+            if( !decoders )
+                decoders = std::max( std::thread::hardware_concurrency(), 1u );
+
+            return decoders * blocks_per_decoder + 2;
+        }
+
+    }
+
+    /**
+     * The rings connecting the reader to one decoder thread, and that decoder to the writer.
+     */
+    struct Pipeline::Lane{
+        Ring<Block*> input, output;
+        Doorbell bell;
+
+        explicit Lane( size_t capacity ) : input( capacity ), output( capacity ){}
+    };
+
+    Pipeline::Pipeline( unsigned int decoders, size_t block_size )
+        : free_blocks( blockCount( decoders ) ), next_lane( 0 )
+    {
+        //Every ring can hold all the blocks there are, so only the reader ever has to wait, for a block to be handed back
+        size_t count = blockCount( decoders );
+
+        if( !decoders )
+            decoders = std::max( std::thread::hardware_concurrency(), 1u );
+
+        for( size_t i = 0; i < count; i++ ){
+            blocks.push_back( std::unique_ptr<Block>( new Block ) );
+            blocks.back()->buffer.resize( block_size );
+            spare_blocks.push_back( blocks.back().get() );
+        }
+
+        for( unsigned int i = 0; i < decoders; i++ )
+            lanes.push_back( std::unique_ptr<Lane>( new Lane( count + 1 ) ) );
+
+        for( unsigned int i = 0; i < decoders; i++ )
+            threads.push_back( std::thread( &Pipeline::decode, this, std::ref( *lanes[i] ) ) );
+
+        threads.push_back( std::thread( &Pipeline::write, this ) );
+    }
+
+    Pipeline::~Pipeline()
+    {
+        //The writer stops at the first empty block in its turn, once everything before it is written
+        for( size_t i = 0; i < lanes.size(); i++ ){
+            Lane &lane = *lanes[( next_lane + i ) % lanes.size()];
+            lane.input.push( NULL );
+            lane.bell.ring();
+        }
+
+        for( size_t i = 0; i < threads.size(); i++ )
+            threads[i].join();
+
+    }
+
+    Block* Pipeline::acquire()
+    {
+        Block *block = NULL;
+
+        if( !spare_blocks.empty() ){
+            block = spare_blocks.back();
+            spare_blocks.pop_back();
+        }else{
+            reader_bell.wait( [this, &block]{ return free_blocks.pop( block ); } );
+        }
+
+        block->begin = block->end = block->decoded = 0;
+        block->crc = 0;
+        block->last = false;
+        block->article = NULL;
+        return block;
+    }
+
+    void Pipeline::submit( Block *block )
+    {
+        Lane &lane = *lanes[next_lane];
+        next_lane = ( next_lane + 1 ) % lanes.size();
+        lane.input.push( block );
+        lane.bell.ring();
+    }
+
+    void Pipeline::release( Block *block )
+    {
+        spare_blocks.push_back( block );
+    }
+
+    void Pipeline::finish( const Article &article )
+    {
+        reader_bell.wait( [&article]{ return article.done.load( std::memory_order_acquire ); } );
+    }
+
+    unsigned int Pipeline::decoders() const
+    {
+        return lanes.size();
+    }
+
+    /**
+    * The loop of a decoder thread. Each block is decoded over itself, starting from a clear escape state, and the crc32
+    * of the decoded data is calculated in the same pass.
+    */
+    void Pipeline::decode( Lane &lane )
+    {
+        //The line endings of the data aren't known before all of it has been read, so look for both kinds
+        const ykernel::SpanDecoder decode_span = ykernel::decoder( ykernel::LineEnding::CRLF, true );
+
+        for( ;; ){
+            Block *block;
+            lane.bell.wait( [&lane, &block]{ return lane.input.pop( block ); } );
+
+            if( block ){
+                ystats::Stopwatch watch;
+                unsigned char *data = reinterpret_cast<unsigned char*>( block->buffer.data() + block->begin );
+                bool escape = false;
+                block->decoded = decode_span( data, block->end - block->begin, data, escape, block->crc );
+                block->decode_time = watch.lap();
+            }
+
+            lane.output.push( block );
+            writer_bell.ring();
+
+            if( !block )
+                return;
+
+        }
+    }
+
+    /**
+    * The loop of the writer thread. The blocks are taken from the decoders in the turn they were dealt out in, so they
+    * are written in the order they were submitted.
+    */
+    void Pipeline::write()
+    {
+        for( size_t turn = 0;; turn = ( turn + 1 ) % lanes.size() ){
+            Lane &lane = *lanes[turn];
+            Block *block;
+            writer_bell.wait( [&lane, &block]{ return lane.output.pop( block ); } );
+
+            if( !block )
+                return;
+
+            ystats::Stopwatch watch;
+            store( *block );
+            block->article->encoded += block->end - block->begin;
+            block->article->decode_time += block->decode_time;
+            block->article->write_time += watch.lap();
+
+            if( block->last )
+                block->article->done.store( true, std::memory_order_release );
+
+            free_blocks.push( block );
+            reader_bell.ring();
+        }
+    }
+
+    /**
+    * Write the decoded data of a block to where its article goes. Data beyond the capacity of the article is dropped,
+    * and once a write has failed, the rest of the article is dropped as well.
+    */
+    void Pipeline::store( Block &block )
+    {
+        Article &article = *block.article;
+        const char *data = block.buffer.data() + block.begin;
+        uint64_t length = std::min<uint64_t>( block.decoded, article.capacity - article.length );
+
+        if( length < block.decoded ){
+            article.overflow = true;
+            block.crc = ycrc32::crc32( 0, data, length );
+        }
+
+        if( !length || article.error )
+            return;
+
+        if( article.fd < 0 ){
+            memcpy( article.memory + article.offset + article.length, data, length );
+        }else if( !yfile::writeAt( article.fd, data, length, article.offset + article.length ) ){
+            article.error = errno;
+            return;
+        }
+
+        article.checksum.combine( block.crc, length );
+        article.length += length;
+    }
+
+}
@@ -0,0 +1,322 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ypipeline
+ * The namespace for the staged decoder, which reads, decodes and writes a file on separate threads at the same time.
+ */
+#ifndef YPIPELINE_YPIPELINE_H
+#define YPIPELINE_YPIPELINE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ycrc32.h"
+
+namespace ypipeline{
+
+    /**
+     * @class Ring ypipeline.h
+     *
+     * @brief A bounded lock-free queue between one producer thread and one consumer thread.
+     *
+     * The producer only ever writes the tail and the consumer only ever writes the head, so neither needs a lock or an
+     * atomic read-modify-write; each side publishes its position with a release store that the other side reads with
+     * an acquire load. The two positions are kept on separate cache lines so the threads don't keep stealing the line
+     * from each other.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    template<typename T>
+    class Ring
+    {
+        public:
+            /**
+             * @param capacity The most values the ring holds at once. This is rounded up to a power of two.
+             */
+            explicit Ring( size_t capacity )
+                : head( 0 ), tail( 0 )
+            {
+                size_t slots_needed = 1;
+
+                while( slots_needed < capacity )
+                    slots_needed <<= 1;
+
+                slots.resize( slots_needed );
+                mask = slots_needed - 1;
+            }
+
+            /**
+             * Add a value at the tail of the ring. Only the producer thread may call this.
+             *
+             * @return \b true if the value was added, \b false if the ring is full.
+             */
+            bool push( const T &value )
+            {
+                size_t position = tail.load( std::memory_order_relaxed );
+
+                if( position - head.load( std::memory_order_acquire ) > mask )
+                    return false;
+
+                slots[position & mask] = value;
+                tail.store( position + 1, std::memory_order_release );
+                return true;
+            }
+
+            /**
+             * Take the value at the head of the ring. Only the consumer thread may call this.
+             *
+             * @return \b true if a value was taken, \b false if the ring is empty.
+             */
+            bool pop( T &value )
+            {
+                size_t position = head.load( std::memory_order_relaxed );
+
+                if( position == tail.load( std::memory_order_acquire ) )
+                    return false;
+
+                value = slots[position & mask];
+                head.store( position + 1, std::memory_order_release );
+                return true;
+            }
+
+            /**
+             * @return \b true if the ring holds no values. Only meaningful to the consumer, as the producer may add to it
+             * at any time.
+             */
+            bool empty() const
+            {
+                return head.load( std::memory_order_relaxed ) == tail.load( std::memory_order_acquire );
+            }
+
+        private:
+            std::vector<T> slots;
+            size_t mask;
+            char before_head[64];
+            std::atomic<size_t> head;
+            char before_tail[64 - sizeof( std::atomic<size_t> )];
+            std::atomic<size_t> tail;
+            char after_tail[64 - sizeof( std::atomic<size_t> )];
+
+            Ring( const Ring& );
+            Ring& operator=( const Ring& );
+    };
+
+    /**
+     * @class Doorbell ypipeline.h
+     *
+     * @brief Lets a thread sleep until another thread has made progress, without a lock on the fast path.
+     *
+     * A waiting thread spins for a while first, as the stages usually catch up with each other within microseconds,
+     * and only then goes to sleep on a condition variable. ring() takes the lock only when a thread is asleep, so
+     * stages that keep up with each other never touch it.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Doorbell
+    {
+        public:
+            Doorbell() : sleepers( 0 ){}
+
+            /**
+             * Block until @p ready returns \b true.
+             */
+            template<typename Ready>
+            void wait( Ready ready )
+            {
+                for( int spin = 0; spin < 2048; spin++ ){
+
+                    if( ready() )
+                        return;
+
+                    pause();
+                }
+
+                std::unique_lock<std::mutex> lock( mutex );
+                sleepers.fetch_add( 1 );
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                while( !ready() )
+                    woken.wait( lock );
+
+                sleepers.fetch_sub( 1 );
+            }
+
+            /**
+             * Wake the threads waiting on the doorbell. Call this after publishing the progress they are waiting for.
+             */
+            void ring()
+            {
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+
+                if( sleepers.load( std::memory_order_relaxed ) ){
+                    std::lock_guard<std::mutex> lock( mutex );
+                    woken.notify_all();
+                }
+
+            }
+
+        private:
+            std::atomic<unsigned int> sleepers;
+            std::mutex mutex;
+            std::condition_variable woken;
+
+            static void pause()
+            {
+#if defined( __x86_64__ ) || defined( __i386__ )
+                __builtin_ia32_pause();
+#else
+                std::this_thread::yield();
+#endif
+            }
+    };
+
+    /**
+     * @struct Article ypipeline.h
+     *
+     * @brief Where the decoded data of one article goes, and what the writer has made of it so far.
+     *
+     * The first group of fields is filled in by the reader before the first block of the article is submitted, and is
+     * not changed after that. The rest is only written by the writer thread, and may be read once Pipeline::finish()
+     * has returned for the article.
+     */
+    struct Article{
+        int fd; /**< The file the data is written to, or -1 to copy it to @p memory */
+        char *memory; /**< The buffer the data is copied to if @p fd is -1 */
+        uint64_t offset; /**< The offset the data starts at, in the file or in @p memory */
+        uint64_t capacity; /**< The most bytes of data written; any data beyond this is dropped */
+        uint64_t length; /**< The number of bytes of data written */
+        uint64_t encoded; /**< The number of bytes of encoded data in the blocks written */
+        uint64_t decode_time; /**< The time the decoder threads spent on the blocks, in nanoseconds */
+        uint64_t write_time; /**< The time the writer thread spent storing the data, in nanoseconds */
+        ycrc32::Crc32 checksum; /**< The crc32 of the data written */
+        int error; /**< The errno value of the first write that failed, or 0 */
+        bool overflow; /**< Set if data had to be dropped because it went beyond @p capacity */
+        std::atomic<bool> done; /**< Set by the writer once the last block of the article has been written */
+
+        Article() : fd( -1 ), memory( NULL ), offset( 0 ), capacity( 0 ), length( 0 ), encoded( 0 ), decode_time( 0 ),
+                    write_time( 0 ), error( 0 ), overflow( false ), done( false ){}
+    };
+
+    /**
+     * @struct Block ypipeline.h
+     *
+     * @brief A fixed size buffer of encoded data on its way through the pipeline. The data is decoded in place.
+     */
+    struct Block{
+        std::vector<char> buffer; /**< The buffer, which holds the encoded data and then the decoded data */
+        size_t begin; /**< The offset in @p buffer the encoded data starts at */
+        size_t end; /**< The offset in @p buffer the encoded data ends at */
+        size_t decoded; /**< The number of bytes of decoded data, starting at @p begin */
+        uint32_t crc; /**< The crc32 of the decoded data */
+        uint64_t decode_time; /**< The time it took to decode the block, in nanoseconds */
+        bool last; /**< Set on the last block of an article */
+        Article *article; /**< The article the data belongs to */
+    };
+
+    /**
+     * @class Pipeline ypipeline.h
+     *
+     * @brief Decodes blocks of encoded data on a set of decoder threads and writes the results on a writer thread,
+     * while the thread that feeds it goes on reading.
+     *
+     * The thread that owns the pipeline reads the input into blocks taken with acquire() and hands them over with
+     * submit(). The blocks are dealt out to the decoder threads in turn, each through a ring of its own, and every
+     * decoder passes its blocks on through another ring of its own to the writer. The writer takes them from the
+     * decoders in the same turn, so the blocks are written in the order they were submitted without sorting them, and
+     * then hands them back to the reader through a ring of free blocks. All the rings are single producer, single
+     * consumer queues. As there is only a fixed number of blocks, a reader that gets ahead of the disk or the decoders
+     * waits in acquire() until a block is free again, so the memory use stays flat.
+     *
+     * A block must end where the escape state of the data is known to be clear, that is just after a byte other than
+     * \c '=' or a line ending, or at the end of the data of an article, as each block is decoded on its own.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Pipeline
+    {
+        public:
+            /**
+             * Start the decoder threads and the writer thread.
+             *
+             * @param decoders The number of decoder threads. 0 starts one thread per processor.
+             *
+             * @param block_size The size of the blocks.
+             */
+            Pipeline( unsigned int decoders, size_t block_size );
+
+            /**
+             * Waits for the blocks submitted so far to be written, then stops the threads.
+             */
+            ~Pipeline();
+
+            /**
+             * Take a free block, waiting for the writer to hand one back if there is none.
+             */
+            Block* acquire();
+
+            /**
+             * Pass a block to the next decoder in turn. The block belongs to the pipeline until acquire() returns it again.
+             */
+            void submit( Block *block );
+
+            /**
+             * Hand back a block taken with acquire() without decoding it.
+             */
+            void release( Block *block );
+
+            /**
+             * Wait until the last block of @p article has been written.
+             */
+            void finish( const Article &article );
+
+            /**
+             * @return The number of decoder threads.
+             */
+            unsigned int decoders() const;
+
+        private:
+            struct Lane;
+
+            //Variables
+            std::vector<std::unique_ptr<Block> > blocks;
+            std::vector<std::unique_ptr<Lane> > lanes;
+            Ring<Block*> free_blocks;
+            std::vector<Block*> spare_blocks;
+            Doorbell reader_bell, writer_bell;
+            std::vector<std::thread> threads;
+            unsigned int next_lane;
+
+            //Functions
+            void decode( Lane &lane );
+            void write();
+            static void store( Block &block );
+
+            Pipeline( const Pipeline& );
+            Pipeline& operator=( const Pipeline& );
+    };
+
+}
+
+#endif
@@ -0,0 +1,341 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "ycrc32.h"
+#include "ydiag.h"
+#include "yfile.h"
+#include "ysession.h"
+#include "ythreadpool.h"
+
+using namespace ydecoder;
+
+namespace ysession{
+
+    namespace{
+
+        string formatMessage( const char *format, ... ) __attribute__(( format( printf, 1, 2 ) ));
+
+        /**
+         * Format a message on a worker thread, to be sent from the thread calling run().
+         */
+        string formatMessage( const char *format, ... )
+        {
+            char buffer[512];
+            va_list args;
+            va_start( args, format );
+            int length = vsnprintf( buffer, sizeof( buffer ), format, args );
+            va_end( args );
+            return string( buffer, length < 0 ? 0 : min( static_cast<size_t>( length ), sizeof( buffer ) - 1 ) );
+        }
+
+    }
+
+    DecodeSession::DecodeSession( const char *path, unsigned int threads, const DecodingOption::Option &decoding )
+        : directory( path ? path : "." ), threads( threads ), decoding( decoding ), remaining( 0 )
+    {
+    }
+
+    DecodeSession::~DecodeSession()
+    {
+    }
+
+    void DecodeSession::add( const string &input )
+    {
+        inputs.push_back( input );
+    }
+
+    void DecodeSession::add( const vector<string> &list )
+    {
+        inputs.insert( inputs.end(), list.begin(), list.end() );
+    }
+
+    DecoderStatus::Status DecodeSession::run()
+    {
+        DecoderStatus::Status status = DecoderStatus::SUCCESS;
+        struct stat info;
+
+        if( stat( directory.c_str(), &info ) != 0 && mkdir( directory.c_str(), 0755 ) != 0 ){
+            YENC_ERROR( error, "Failed to create directory %s : %s", directory.c_str(), strerror( errno ) );
+            return DecoderStatus::FAILED;
+        }
+
+        {
+            ythreadpool::ThreadPool pool( threads );
+            std::unique_lock<std::mutex> lock( mutex );
+            remaining = inputs.size();
+
+            for( size_t i = 0; i < inputs.size(); i++ ){
+                const string *input = &inputs[i];
+                pool.schedule( [this, input]{ decodeFile( *input ); } );
+            }
+
+            //Report the files as they finish, while the workers carry on
+            for( ;; ){
+
+                while( events.empty() && remaining )
+                    event_ready.wait( lock );
+
+                if( events.empty() )
+                    break;
+
+                std::deque<Event> ready;
+                ready.swap( events );
+                lock.unlock();
+                status |= dispatch( ready );
+                lock.lock();
+            }
+        }
+
+        //Whatever is left is missing some of its articles
+        for( map<string, Target>::iterator it = targets.begin(); it != targets.end(); ++it ){
+
+            if( it->second.done )
+                continue;
+
+            it->second.status |= DecoderStatus::SIZE_MISMATCH;
+            post( Event::WARNING_MESSAGE, formatMessage( "Missing parts of %s", it->first.c_str() ) );
+            finishTarget( it->first, it->second );
+        }
+
+        status |= dispatch( events );
+        inputs.clear();
+        targets.clear();
+        return status;
+    }
+
+    /**
+    * Decode all the articles in an input file. Runs on a worker thread.
+    */
+    void DecodeSession::decodeFile( const string &input )
+    {
+        //Each worker keeps its decoder, so its output buffer is reused from article to article
+        thread_local YDecoder decoder;
+        yfile::MappedFile file;
+        bool opened = file.map( input );
+
+        if( opened ){
+            const char *text = file.data();
+            const char *end = text + file.size();
+
+            while( text < end ){
+                DecodeResult result = decoder.decode( text, end - text, NULL, 0, decoding );
+
+                if( !result.consumed ){
+
+                    if( result.line || result.size || result.name_length ){
+                        std::lock_guard<std::mutex> lock( mutex );
+                        post( Event::ERROR_MESSAGE, formatMessage( "Failed to parse header in %s", input.c_str() ), DecoderStatus::FAILED );
+                    }
+
+                    break;
+                }
+
+                text += result.consumed;
+                addArticle( input, result );
+                file.release( text );
+            }
+
+        }
+
+        std::lock_guard<std::mutex> lock( mutex );
+
+        if( !opened )
+            post( Event::ERROR_MESSAGE, formatMessage( "Failed to open file %s", input.c_str() ), DecoderStatus::FAILED );
+
+        if( !--remaining )
+            event_ready.notify_one();
+
+    }
+
+    /**
+    * Write the decoded data of an article to its target file, creating the file if this is its first article.
+    * Runs on a worker thread.
+    */
+    void DecodeSession::addArticle( const string &input, const DecodeResult &result )
+    {
+        string name( result.name, result.name_length );
+        uint64_t begin = result.part ? result.begin : 1;
+        //The name comes from the header, so it mustn't lead out of the directory
+        bool unsafe = name == "." || name == ".." || name.find_first_of( string( "/\0", 2 ) ) != string::npos;
+
+        std::unique_lock<std::mutex> lock( mutex );
+
+        if( name.empty() || unsafe || !begin || begin - 1 + result.length > result.size ){
+            post( Event::ERROR_MESSAGE, formatMessage( "Invalid article in %s", input.c_str() ), DecoderStatus::FAILED );
+            return;
+        }
+
+        map<string, Target>::iterator it = targets.find( name );
+
+        if( it == targets.end() ){
+            Target target;
+            target.fd = yfile::createFile( directory + "/" + name, result.size );
+            target.size = result.size;
+            target.written = 0;
+            target.crc = 0;
+            target.writing = 0;
+            target.status = DecoderStatus::SUCCESS;
+            target.done = false;
+
+            if( target.fd < 0 ){
+                target.status = DecoderStatus::FAILED;
+                target.done = true;
+                post( Event::ERROR_MESSAGE, formatMessage( "Failed to create %s : %s", name.c_str(), strerror( errno ) ) );
+                post( Event::FINISHED, name, target.status );
+            }
+
+            it = targets.insert( make_pair( name, target ) ).first;
+        }
+
+        Target &target = it->second;
+
+        if( target.done )
+            return;
+
+        //Articles are often posted more than once, only the first copy counts
+        for( size_t i = 0; i < target.pieces.size(); i++ ){
+            const Piece &other = target.pieces[i];
+
+            if( other.begin == begin )
+                return;
+
+            if( begin < other.begin + other.length && other.begin < begin + result.length ){
+                post( Event::WARNING_MESSAGE, formatMessage( "Part %llu of %s overlaps another part",
+                                                             static_cast<unsigned long long>( result.part ), name.c_str() ) );
+                return;
+            }
+
+        }
+
+        if( result.size != target.size ){
+            target.status |= DecoderStatus::SIZE_MISMATCH;
+            post( Event::WARNING_MESSAGE, formatMessage( "Size mismatch in part %llu of %s",
+                                                         static_cast<unsigned long long>( result.part ), name.c_str() ) );
+            return;
+        }
+
+        if( result.status & DecoderStatus::PART_CRC_MISMATCH ){
+            post( Event::WARNING_MESSAGE, formatMessage( "pcrc mismatch in part %llu of %s",
+                                                         static_cast<unsigned long long>( result.part ), name.c_str() ) );
+
+            if( decoding == DecodingOption::STRICT ){
+                target.status |= result.status;
+                return;
+            }
+
+        }
+
+        //Claim the range before writing, so a duplicate can't be written at the same time
+        Piece piece = { begin, result.length, result.checksum };
+        target.pieces.push_back( piece );
+        target.status |= result.status;
+
+        if( result.crc )
+            target.crc = result.crc;
+
+        //The file is only closed once the last write to it is done
+        int fd = target.fd;
+        target.writing++;
+        lock.unlock();
+        bool written = yfile::writeAt( fd, result.data, result.length, begin - 1 );
+        lock.lock();
+        target.writing--;
+
+        if( !written ){
+            target.status |= DecoderStatus::FAILED;
+            post( Event::ERROR_MESSAGE, formatMessage( "Failed to write to %s : %s", name.c_str(), strerror( errno ) ) );
+        }
+
+        target.written += result.length;
+
+        if( target.written >= target.size && !target.writing )
+            finishTarget( name, target );
+
+    }
+
+    /**
+    * Close a target file, and check its crc32 from the crcs of its pieces. Call with the mutex held.
+    */
+    void DecodeSession::finishTarget( const string &name, Target &target )
+    {
+        sort( target.pieces.begin(), target.pieces.end(), []( const Piece &a, const Piece &b ){ return a.begin < b.begin; } );
+        ycrc32::Crc32 crc;
+
+        for( size_t i = 0; i < target.pieces.size() && target.pieces[i].begin == crc.size() + 1; i++ )
+            crc.combine( target.pieces[i].crc, target.pieces[i].length );
+
+        if( crc.size() != target.size ){
+            target.status |= DecoderStatus::SIZE_MISMATCH;
+        }else if( target.crc && target.crc != crc.checksum() ){
+            target.status |= DecoderStatus::CRC_MISMATCH;
+            post( Event::WARNING_MESSAGE, formatMessage( "crc mismatch in %s", name.c_str() ) );
+        }
+
+        if( target.fd >= 0 )
+            close( target.fd );
+
+        target.fd = -1;
+        target.done = true;
+        vector<Piece>().swap( target.pieces );
+        post( Event::FINISHED, name, target.status );
+    }
+
+    /**
+    * Queue an event for the thread calling run(). Call with the mutex held.
+    */
+    void DecodeSession::post( Event::Kind kind, const string &text, DecoderStatus::Status status )
+    {
+        Event event = { kind, text, status };
+        events.push_back( event );
+        event_ready.notify_one();
+    }
+
+    /**
+    * Emit the signals for a list of events.
+    *
+    * @return The combined status of the events.
+    */
+    DecoderStatus::Status DecodeSession::dispatch( std::deque<Event> &ready )
+    {
+        DecoderStatus::Status status = DecoderStatus::SUCCESS;
+
+        for( ; !ready.empty(); ready.pop_front() ){
+            Event &event = ready.front();
+            status |= event.status;
+
+            if( event.kind == Event::FINISHED )
+                finished.emit( event.text, event.status );
+            else if( event.kind == Event::WARNING_MESSAGE )
+                YENC_WARNING( warning, "%s", event.text.c_str() );
+            else
+                YENC_ERROR( error, "%s", event.text.c_str() );
+
+        }
+
+        return status;
+    }
+
+}
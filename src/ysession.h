@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ysession
+ * The namespace for decoding batches of articles that belong to many different files.
+ */
+#ifndef YSESSION_YSESSION_H
+#define YSESSION_YSESSION_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include "ydecoder.h"
+
+namespace ysession{
+
+    /**
+     * @class DecodeSession ysession.h
+     *
+     * @brief Decodes a batch of articles belonging to any number of files, in parallel.
+     *
+     * Where YDecoder assembles one file at a time, a session takes any number of input files, each holding one
+     * or more articles, in any order and belonging to any number of target files. The input files are decoded on
+     * a work-stealing thread pool. Each article is written straight to its offset in its target file, which is
+     * created in the output directory the first time one of its articles is seen. As soon as all the data of a
+     * target file has been written, its crc32 is checked and the finished signal is emitted for it, while the rest
+     * of the batch is still being decoded:
+     *
+     * @code
+     * DecodeSession session( "/srv/incoming", 8 );
+     * session.finished.connect( sigc::ptr_fun( done ) );
+     * session.add( files );
+     * session.run();
+     * @endcode
+     *
+     * All signals are emitted from the thread that called run().
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     *
+     * @see YDecoder
+     */
+    class DecodeSession : public trackable
+    {
+        public:
+            //Functions
+            /**
+             * @param path The directory to write the decoded files to. It is created if it doesn't exist.
+             *
+             * @param threads The number of threads to decode with. 0 uses one thread per processor.
+             *
+             * @param decoding With STRICT, articles that fail their pcrc32 check are not written. With FORCE, they
+             * are written anyway.
+             */
+            DecodeSession( const char *path, unsigned int threads = 0,
+                           const ydecoder::DecodingOption::Option &decoding = ydecoder::DecodingOption::STRICT );
+            ~DecodeSession();
+
+            /**
+             * Add an input file to the batch. The file may hold any number of articles.
+             */
+            void add( const string &input );
+
+            /**
+             * Add a list of input files to the batch.
+             */
+            void add( const vector<string> &inputs );
+
+            /**
+             * Decode all the input files added so far, and wait until they are done. Target files that are still
+             * missing data once all the input has been decoded are reported as finished with the SIZE_MISMATCH flag
+             * set. The batch is emptied afterwards, so the session can be reused.
+             *
+             * @return The status of all the target files combined, with the FAILED flag set if an input file couldn't
+             * be read.
+             */
+            ydecoder::DecoderStatus::Status run();
+
+            //Signals
+            /**
+             * Signal emitted when a target file is complete, with its name and its status.
+             */
+            signal<void, string, ydecoder::DecoderStatus::Status> finished;
+
+            /**
+             * Signal you can connect to to recieve warnings from the session
+             */
+            signal<void, string> warning;
+
+            /**
+             * Signal you can connect to to recieve errors from the session
+             */
+            signal<void, string> error;
+
+        private:
+            /**
+             * A range of a target file that has been written.
+             */
+            struct Piece{
+                uint64_t begin;
+                uint64_t length;
+                uint32_t crc;
+            };
+
+            /**
+             * The state of a file being assembled from its articles.
+             */
+            struct Target{
+                int fd;
+                uint64_t size;
+                uint64_t written;
+                uint32_t crc;
+                vector<Piece> pieces;
+                unsigned writing;
+                ydecoder::DecoderStatus::Status status;
+                bool done;
+            };
+
+            /**
+             * Something to report from the thread calling run().
+             */
+            struct Event{
+                enum Kind{ FINISHED, WARNING_MESSAGE, ERROR_MESSAGE } kind;
+                string text;
+                ydecoder::DecoderStatus::Status status;
+            };
+
+            //Variables
+            const string directory;
+            const unsigned int threads;
+            const ydecoder::DecodingOption::Option decoding;
+            vector<string> inputs;
+            map<string, Target> targets;
+            std::deque<Event> events;
+            std::mutex mutex;
+            std::condition_variable event_ready;
+            size_t remaining;
+
+            //Functions
+            void decodeFile( const string &input );
+            void addArticle( const string &input, const ydecoder::DecodeResult &result );
+            void finishTarget( const string &name, Target &target );
+            void post( Event::Kind kind, const string &text, ydecoder::DecoderStatus::Status status = ydecoder::DecoderStatus::SUCCESS );
+            ydecoder::DecoderStatus::Status dispatch( std::deque<Event> &ready );
+    };
+
+}
+
+#endif
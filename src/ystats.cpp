@@ -0,0 +1,181 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "ystats.h"
+
+namespace ystats{
+
+    namespace{
+
+        /**
+         * The fields of Stats, in the order their counters are kept in.
+         */
+        uint64_t Stats::* const fields[] = {
+            &Stats::articles, &Stats::parts, &Stats::bytes_in, &Stats::bytes_out, &Stats::lines, &Stats::escapes,
+            &Stats::crc_mismatches, &Stats::size_mismatches, &Stats::failures, &Stats::header_ns, &Stats::decode_ns,
+            &Stats::write_ns
+        };
+
+        const size_t field_count = sizeof( fields ) / sizeof( fields[0] );
+
+        static_assert( field_count == 12, "Counters keeps a counter for every field of Stats" );
+
+        /**
+         * The counters of one thread. Only the thread itself adds to them, so the additions never contend.
+         */
+        struct Shard{
+            std::atomic<uint64_t> values[field_count];
+
+            Shard();
+            ~Shard();
+        };
+
+        /**
+         * The shards of the running threads, and the totals of the threads that have ended.
+         */
+        struct Registry{
+            std::mutex mutex;
+            std::vector<Shard*> shards;
+            Stats retired;
+        };
+
+        Registry& registry()
+        {
+            static Registry instance;
+            return instance;
+        }
+
+        Shard::Shard()
+        {
+            for( size_t i = 0; i < field_count; i++ )
+                values[i].store( 0, std::memory_order_relaxed );
+
+            Registry &totals = registry();
+            std::lock_guard<std::mutex> lock( totals.mutex );
+            totals.shards.push_back( this );
+        }
+
+        Shard::~Shard()
+        {
+            Registry &totals = registry();
+            std::lock_guard<std::mutex> lock( totals.mutex );
+
+            for( size_t i = 0; i < field_count; i++ )
+                totals.retired.*fields[i] += values[i].load( std::memory_order_relaxed );
+
+            totals.shards.erase( std::find( totals.shards.begin(), totals.shards.end(), this ) );
+        }
+
+        Shard& localShard()
+        {
+            thread_local Shard shard;
+            return shard;
+        }
+
+        void load( const std::atomic<uint64_t> *values, Stats &stats )
+        {
+            for( size_t i = 0; i < field_count; i++ )
+                stats.*fields[i] += values[i].load( std::memory_order_relaxed );
+
+        }
+    }
+
+    double Stats::escapeRatio() const
+    {
+        return lines ? static_cast<double>( escapes ) / ( escapes + bytes_out ) : 0.0;
+    }
+
+    double Stats::decodeSpeed() const
+    {
+        return decode_ns ? bytes_out * 1000.0 / decode_ns : 0.0;
+    }
+
+    Stats& Stats::operator+=( const Stats &other )
+    {
+        for( size_t i = 0; i < field_count; i++ )
+            this->*fields[i] += other.*fields[i];
+
+        return *this;
+    }
+
+    Counters::Counters()
+    {
+        reset();
+    }
+
+    void Counters::add( const Stats &stats )
+    {
+        Shard &shard = localShard();
+
+        for( size_t i = 0; i < field_count; i++ ){
+            uint64_t value = stats.*fields[i];
+
+            if( value ){
+                values[i].fetch_add( value, std::memory_order_relaxed );
+                shard.values[i].fetch_add( value, std::memory_order_relaxed );
+            }
+
+        }
+    }
+
+    Stats Counters::snapshot() const
+    {
+        Stats stats;
+        load( values, stats );
+        return stats;
+    }
+
+    void Counters::reset()
+    {
+        for( size_t i = 0; i < field_count; i++ )
+            values[i].store( 0, std::memory_order_relaxed );
+
+    }
+
+    Stats global()
+    {
+        Registry &totals = registry();
+        std::lock_guard<std::mutex> lock( totals.mutex );
+        Stats stats = totals.retired;
+
+        for( size_t i = 0; i < totals.shards.size(); i++ )
+            load( totals.shards[i]->values, stats );
+
+        return stats;
+    }
+
+    void resetGlobal()
+    {
+        Registry &totals = registry();
+        std::lock_guard<std::mutex> lock( totals.mutex );
+        totals.retired = Stats();
+
+        for( size_t i = 0; i < totals.shards.size(); i++ ){
+
+            for( size_t j = 0; j < field_count; j++ )
+                totals.shards[i]->values[j].store( 0, std::memory_order_relaxed );
+
+        }
+    }
+
+}
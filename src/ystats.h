@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ystats
+ * The namespace for the performance counters of the decoders, which count what has been decoded and where the time went.
+ */
+#ifndef YSTATS_YSTATS_H
+#define YSTATS_YSTATS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+namespace ystats{
+
+    /**
+     * @struct Stats ystats.h
+     *
+     * @brief A snapshot of the counters of a decoder, or of all decoders together.
+     *
+     * The lines and escapes are only counted by the decoding that splits the data into lines anyway, which is all of it
+     * except the NNTP article format and the PIPELINED input mode; those find the end of the data without looking at the
+     * lines. The crc32 is calculated in the same pass as the decoding, so its time is part of the decode time. The times
+     * are added up over the threads that did the work, so with several threads they can come to more than the time that
+     * has passed.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    struct Stats{
+        uint64_t articles; /**< The number of articles decoded */
+        uint64_t parts; /**< The number of those articles that were a part of a multipart file */
+        uint64_t bytes_in; /**< The number of bytes of encoded data, not counting the headers and trailers */
+        uint64_t bytes_out; /**< The number of bytes of decoded data */
+        uint64_t lines; /**< The number of lines of encoded data */
+        uint64_t escapes; /**< The number of escape characters in those lines */
+        uint64_t crc_mismatches; /**< The number of articles whose pcrc32 or crc32 didn't match the data */
+        uint64_t size_mismatches; /**< The number of articles whose size didn't match the data */
+        uint64_t failures; /**< The number of articles that failed to decode or to be written */
+        uint64_t header_ns; /**< The time spent finding and parsing the headers and trailers, in nanoseconds */
+        uint64_t decode_ns; /**< The time spent decoding and checksumming the data, in nanoseconds */
+        uint64_t write_ns; /**< The time spent writing the decoded data to disk, in nanoseconds */
+
+        Stats() : articles( 0 ), parts( 0 ), bytes_in( 0 ), bytes_out( 0 ), lines( 0 ), escapes( 0 ), crc_mismatches( 0 ),
+                  size_mismatches( 0 ), failures( 0 ), header_ns( 0 ), decode_ns( 0 ), write_ns( 0 ){}
+
+        /**
+         * @return The share of escape characters in the encoded data, not counting the line endings, between 0 and 1. Plain
+         * text data stays close to 0, while data made up of the bytes that encode to NUL, LF, CR or '=', which are 0xD6,
+         * 0xE0, 0xE3 and 0x13, is all escaped and comes to 0.5. As the escapes are only counted along with the lines, data
+         * whose lines weren't counted brings the ratio down.
+         */
+        double escapeRatio() const;
+
+        /**
+         * @return The decoded data per second of decoding, in MB/s.
+         */
+        double decodeSpeed() const;
+
+        /**
+         * Add the counts of @p other to these.
+         */
+        Stats& operator+=( const Stats &other );
+    };
+
+    /**
+     * @class Counters ystats.h
+     *
+     * @brief The running counters of one decoder.
+     *
+     * The counters are relaxed atomics, so a decoder that works on several threads at once can add to them from all of
+     * them, and snapshot() can be called from any thread while it does. Everything added is also added to a set of
+     * counters of the calling thread, which global() adds up, so the totals of the process don't bounce one cache line
+     * between the threads.
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class Counters
+    {
+        public:
+            Counters();
+
+            /**
+             * Add the counts of @p stats, typically those of one article, to the counters and to the global totals.
+             */
+            void add( const Stats &stats );
+
+            /**
+             * @return The counters as they are now.
+             */
+            Stats snapshot() const;
+
+            /**
+             * Set the counters back to 0. The global totals are not affected.
+             */
+            void reset();
+
+        private:
+            //Variables
+            std::atomic<uint64_t> values[12];
+
+            Counters( const Counters& );
+            Counters& operator=( const Counters& );
+    };
+
+    /**
+     * @return The totals of all decoders in the process since it started, or since the last resetGlobal().
+     */
+    Stats global();
+
+    /**
+     * Set the global totals back to 0.
+     */
+    void resetGlobal();
+
+    /**
+     * @class Stopwatch ystats.h
+     *
+     * @brief Times the stages of decoding an article on the monotonic clock.
+     */
+    class Stopwatch
+    {
+        public:
+            Stopwatch() : start( std::chrono::steady_clock::now() ){}
+
+            /**
+             * @return The nanoseconds since the stopwatch was started or last lapped, after which it starts over.
+             */
+            uint64_t lap()
+            {
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>( now - start ).count();
+                start = now;
+                return elapsed;
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start;
+    };
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "ythreadpool.h"
+
+namespace ythreadpool{
+
+    namespace{
+
+        /**
+         * The pool and queue of the worker running on this thread, so jobs scheduled by a job stay on its worker.
+         */
+        thread_local ThreadPool *current_pool = NULL;
+        thread_local unsigned int current_queue = 0;
+
+    }
+
+    ThreadPool::ThreadPool( unsigned int threads )
+        : queued( 0 ), next_queue( 0 ), pending( 0 ), stopping( false )
+    {
+        if( !threads )
+            threads = std::thread::hardware_concurrency();
+
+        if( !threads )
+            threads = 1;
+
+        for( unsigned int i = 0; i < threads; i++ )
+            queues.push_back( std::unique_ptr<Queue>( new Queue ) );
+
+        for( unsigned int i = 0; i < threads; i++ )
+            workers.push_back( std::thread( &ThreadPool::run, this, i ) );
+
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        wait();
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+
+        job_available.notify_all();
+
+        for( size_t i = 0; i < workers.size(); i++ )
+            workers[i].join();
+
+    }
+
+    void ThreadPool::schedule( const Job &job )
+    {
+        unsigned int index = current_pool == this ? current_queue : next_queue++ % queues.size();
+
+        //Count the job under the pool mutex, so a worker can't miss it between checking the count and going to sleep
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            pending++;
+            queued++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( queues[index]->mutex );
+            queues[index]->jobs.push_back( job );
+        }
+
+        job_available.notify_one();
+    }
+
+    void ThreadPool::wait()
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+
+        while( pending )
+            jobs_done.wait( lock );
+
+    }
+
+    unsigned int ThreadPool::size() const
+    {
+        return workers.size();
+    }
+
+    /**
+     * Take the newest job from the queue of worker @p index, or failing that the oldest job of another worker.
+     *
+     * @return \b true if a job was taken, otherwise \b false.
+     */
+    bool ThreadPool::take( unsigned int index, Job &job )
+    {
+        for( size_t i = 0; i < queues.size(); i++ ){
+            Queue &queue = *queues[( index + i ) % queues.size()];
+            std::lock_guard<std::mutex> lock( queue.mutex );
+
+            if( queue.jobs.empty() )
+                continue;
+
+            if( !i ){
+                job.swap( queue.jobs.back() );
+                queue.jobs.pop_back();
+            }else{
+                job.swap( queue.jobs.front() );
+                queue.jobs.pop_front();
+            }
+
+            queued--;
+            return true;
+        }
+
+        return false;
+    }
+
+    void ThreadPool::run( unsigned int index )
+    {
+        current_pool = this;
+        current_queue = index;
+
+        for( ;; ){
+            Job job;
+
+            if( take( index, job ) ){
+                job();
+                std::lock_guard<std::mutex> lock( mutex );
+
+                if( !--pending )
+                    jobs_done.notify_all();
+
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( mutex );
+
+            while( !queued && !stopping )
+                job_available.wait( lock );
+
+            if( !queued && stopping )
+                return;
+
+        }
+    }
+
+}
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Lawrence Lee                                    *
+ *   valheru.ashen.shugar@gmail.com                                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * @namespace ythreadpool
+ * The namespace for the thread pool that runs the parallel encoding and decoding jobs.
+ */
+#ifndef YTHREADPOOL_YTHREADPOOL_H
+#define YTHREADPOOL_YTHREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ythreadpool{
+
+    /**
+     * @class ThreadPool ythreadpool.h
+     *
+     * @brief A fixed set of worker threads running jobs, balanced by work stealing.
+     *
+     * Every worker has its own queue. Jobs scheduled from outside the pool are spread over the queues in turn, and
+     * jobs scheduled by a running job go to the queue of its own worker, which runs the newest job first. A worker
+     * whose queue is empty steals the oldest job from the queue of another worker, so a few large jobs don't hold
+     * up the small ones queued behind them.
+     *
+     * Jobs must not throw, and must not emit any of the sigc++ signals of the library, since those are not thread safe;
+     * collect the results in the job and report them from the thread that called wait().
+     *
+     * @author Lawrence Lee <valheru.ashen.shugar@gmail.com>
+     */
+    class ThreadPool
+    {
+        public:
+            typedef std::function<void()> Job;
+
+            /**
+             * @param threads The number of worker threads. 0 starts one thread per processor.
+             */
+            explicit ThreadPool( unsigned int threads = 0 );
+
+            /**
+             * Waits for all scheduled jobs to finish, then stops the worker threads.
+             */
+            ~ThreadPool();
+
+            /**
+             * Queue a job to be run by one of the worker threads. This may be called from a running job.
+             */
+            void schedule( const Job &job );
+
+            /**
+             * Block until every job scheduled so far has finished, including the jobs they scheduled. Don't call
+             * this from a running job.
+             */
+            void wait();
+
+            /**
+             * @return The number of worker threads.
+             */
+            unsigned int size() const;
+
+        private:
+            struct Queue{
+                std::mutex mutex;
+                std::deque<Job> jobs;
+            };
+
+            //Variables
+            std::vector<std::thread> workers;
+            std::vector<std::unique_ptr<Queue> > queues;
+            std::mutex mutex;
+            std::condition_variable job_available, jobs_done;
+            std::atomic<unsigned int> queued, next_queue;
+            unsigned int pending;
+            bool stopping;
+
+            //Functions
+            void run( unsigned int index );
+            bool take( unsigned int index, Job &job );
+    };
+
+}
+
+#endif